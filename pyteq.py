@@ -1,5 +1,12 @@
 import teq
 
+# numpy dtypes matching the event structs. Use them with the bulk methods
+# of patterns (get_midi_events(), set_midi_events(), etc.), e.g.:
+# events = numpy.zeros((number_of_tracks, number_of_ticks), dtype = pyteq.midi_event_dtype)
+midi_event_dtype = [('type', '<i4'), ('value1', '<u4'), ('value2', '<u4'), ('length', '<f4')]
+cv_event_dtype = [('type', '<i4'), ('value1', '<f4'), ('value2', '<f4')]
+control_event_dtype = [('type', '<i4'), ('value', '<f4')]
+
 # Some utility functions to make life easier in the long run
 def set_loop_range(t, start_pattern, start_tick, end_pattern, end_tick, onoff):
 	r = teq.loop_range(start_pattern, start_tick, end_pattern, end_tick, onoff)
@@ -13,6 +20,9 @@ def set_loop_enabled(t, onoff):
 def set_transport_position(t, pattern, tick):
 	t.set_transport_position(teq.transport_position(pattern, tick))
 
+def render(t, midi_file_name, wav_file_name_prefix = "", sample_rate = 48000, period_size = 1024):
+	return t.render(midi_file_name, wav_file_name_prefix, sample_rate, period_size)
+
 def play(t):
 	t.set_transport_state(teq.transport_state.PLAYING)
 
@@ -0,0 +1,145 @@
+#ifndef LIBTEQ_BACKEND_HH
+#define LIBTEQ_BACKEND_HH
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <teq/midi_event.h>
+
+namespace teq
+{
+	typedef uint32_t nframes_t;
+
+	/**
+	 * The interface between the engine and the audio system. It
+	 * covers the ports and their buffers, the clock and the transport.
+	 *
+	 * All methods marked as RT-safe are called from within the
+	 * process callback. All others are only called from the non-RT
+	 * side.
+	 */
+	struct backend
+	{
+		/**
+		 * Ports are owned by the backend. The engine only stores
+		 * pointers to them.
+		 */
+		struct port
+		{
+			virtual ~port() { }
+		};
+
+		enum port_type { MIDI_OUTPUT, MIDI_INPUT, AUDIO_OUTPUT };
+
+		typedef int (*process_callback)(nframes_t nframes, void *arg);
+
+		struct transport_info
+		{
+			bool m_rolling;
+
+			nframes_t m_frame;
+
+			//! True if m_beats_per_minute holds a valid tempo
+			bool m_has_beats_per_minute;
+
+			double m_beats_per_minute;
+
+			transport_info() :
+				m_rolling(false),
+				m_frame(0),
+				m_has_beats_per_minute(false),
+				m_beats_per_minute(120)
+			{
+
+			}
+		};
+
+		struct midi_input_event
+		{
+			nframes_t m_time;
+
+			size_t m_size;
+
+			const unsigned char *m_data;
+		};
+
+		virtual ~backend() { }
+
+		/**
+		 * A backend that is clocked manually does not call the process
+		 * callback on its own. Commands sent to the engine are then
+		 * executed right away instead of waiting for the next period.
+		 */
+		virtual bool is_clocked_manually() const = 0;
+
+		virtual void set_process_callback(process_callback callback, void *arg) = 0;
+
+		virtual void activate() = 0;
+
+		virtual void deactivate() = 0;
+
+		//! Throws on failure
+		virtual port *register_port(const std::string &name, port_type type) = 0;
+
+		//! Throws on failure
+		virtual void rename_port(port *the_port, const std::string &name) = 0;
+
+		//! the_port must not be in use by the process callback anymore
+		virtual void unregister_port(port *the_port) = 0;
+
+		//! RT-safe
+		virtual void *get_buffer(port *the_port, nframes_t nframes) = 0;
+
+		//! RT-safe
+		virtual void clear_midi_buffer(void *port_buffer) = 0;
+
+		/**
+		 * RT-safe. Returns 0 if the event does not fit into the buffer
+		 * anymore.
+		 */
+		virtual unsigned char *reserve_midi_event(void *port_buffer, nframes_t time, size_t size) = 0;
+
+		/**
+		 * RT-safe. Writes all messages at the same frame. Messages
+		 * that do not fit into the buffer anymore are dropped.
+		 */
+		virtual void write_midi_messages(void *port_buffer, nframes_t time, const midi::message *messages, size_t count)
+		{
+			for (size_t index = 0; index < count; ++index)
+			{
+				unsigned char *event_buffer = reserve_midi_event(port_buffer, time, messages[index].m_size);
+
+				if (0 == event_buffer)
+				{
+					return;
+				}
+
+				for (unsigned char byte_index = 0; byte_index < messages[index].m_size; ++byte_index)
+				{
+					event_buffer[byte_index] = messages[index].m_data[byte_index];
+				}
+			}
+		}
+
+		//! RT-safe
+		virtual uint32_t get_midi_event_count(void *port_buffer) = 0;
+
+		//! RT-safe
+		virtual bool get_midi_event(void *port_buffer, uint32_t index, midi_input_event &event) = 0;
+
+		//! RT-safe. The frame time of the first frame of the current period
+		virtual nframes_t last_frame_time() = 0;
+
+		//! RT-safe
+		virtual nframes_t sample_rate() = 0;
+
+		//! RT-safe
+		virtual transport_info query_transport() = 0;
+	};
+
+	typedef std::shared_ptr<backend> backend_ptr;
+} // namespace
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef LIBTEQ_COMMAND_HH
+#define LIBTEQ_COMMAND_HH
+
+#include <type_traits>
+
+#include <teq/transport.h>
+#include <teq/range.h>
+
+namespace teq
+{
+	/**
+	 * The settings a teq::transaction changes. The RT thread applies
+	 * all of them at once when it executes a COMMIT_TRANSACTION 
+	 * command. Each setting is only applied if its m_set_* flag is 
+	 * true. The song itself is published separately (see teq::m_song).
+	 */
+	struct transaction_state
+	{
+		bool m_set_loop_range;
+		loop_range m_loop_range;
+
+		bool m_set_global_tempo;
+		float m_global_tempo;
+
+		bool m_set_ticks_per_beat;
+		int m_ticks_per_beat;
+
+		bool m_set_transport_source;
+		transport_source m_transport_source;
+
+		bool m_set_transport_state;
+		transport_state m_transport_state;
+
+		bool m_set_transport_position;
+		transport_position m_transport_position;
+
+		bool m_set_send_all_notes_off_on_loop;
+		bool m_send_all_notes_off_on_loop;
+
+		bool m_set_send_all_notes_off_on_stop;
+		bool m_send_all_notes_off_on_stop;
+
+		transaction_state() :
+			m_set_loop_range(false),
+			m_set_global_tempo(false),
+			m_global_tempo(0),
+			m_set_ticks_per_beat(false),
+			m_ticks_per_beat(0),
+			m_set_transport_source(false),
+			m_transport_source(INTERNAL),
+			m_set_transport_state(false),
+			m_transport_state(STOPPED),
+			m_set_transport_position(false),
+			m_set_send_all_notes_off_on_loop(false),
+			m_send_all_notes_off_on_loop(false),
+			m_set_send_all_notes_off_on_stop(false),
+			m_send_all_notes_off_on_stop(false)
+		{
+
+		}
+
+		bool changes_settings() const
+		{
+			return m_set_loop_range || m_set_global_tempo || m_set_ticks_per_beat || m_set_transport_source || m_set_transport_state || m_set_transport_position || m_set_send_all_notes_off_on_loop || m_set_send_all_notes_off_on_stop;
+		}
+	};
+
+	/**
+	 * A command sent from the non-RT side to the RT thread through the
+	 * command ringbuffer. It is a fixed-size, trivially copyable tagged
+	 * union, so neither writing nor executing a command ever touches
+	 * the allocator.
+	 *
+	 * Use the static factory methods to create commands. Only the
+	 * union member matching m_type is valid.
+	 */
+	struct command
+	{
+		enum type
+		{
+			NONE,
+			SET_LOOP_RANGE,
+			SET_GLOBAL_TEMPO,
+			SET_TICKS_PER_BEAT,
+			SET_TRANSPORT_SOURCE,
+			SET_TRANSPORT_STATE,
+			SET_TRANSPORT_POSITION,
+			SET_SEND_ALL_NOTES_OFF_ON_LOOP,
+			SET_SEND_ALL_NOTES_OFF_ON_STOP,
+			COMMIT_TRANSACTION
+		};
+
+		type m_type;
+
+		union
+		{
+			//! SET_LOOP_RANGE
+			struct
+			{
+				tick m_start_pattern;
+				tick m_start_tick;
+				tick m_end_pattern;
+				tick m_end_tick;
+				bool m_enabled;
+			} m_loop_range;
+
+			//! SET_GLOBAL_TEMPO
+			float m_tempo;
+
+			//! SET_TICKS_PER_BEAT
+			int m_ticks;
+
+			//! SET_TRANSPORT_SOURCE
+			transport_source m_transport_source;
+
+			//! SET_TRANSPORT_STATE
+			transport_state m_transport_state;
+
+			//! SET_TRANSPORT_POSITION
+			struct
+			{
+				tick m_pattern;
+				tick m_tick;
+			} m_transport_position;
+
+			//! SET_SEND_ALL_NOTES_OFF_ON_LOOP, SET_SEND_ALL_NOTES_OFF_ON_STOP
+			bool m_on;
+
+			/**
+			 * COMMIT_TRANSACTION: Kept alive by the pending completion
+			 * of the command (see teq::write_command_async()).
+			 */
+			const transaction_state *m_transaction_state;
+		};
+
+		static command none()
+		{
+			command c;
+			c.m_type = NONE;
+			return c;
+		}
+
+		static command set_loop_range(const loop_range &range)
+		{
+			command c;
+			c.m_type = SET_LOOP_RANGE;
+			c.m_loop_range.m_start_pattern = range.m_start.m_pattern;
+			c.m_loop_range.m_start_tick = range.m_start.m_tick;
+			c.m_loop_range.m_end_pattern = range.m_end.m_pattern;
+			c.m_loop_range.m_end_tick = range.m_end.m_tick;
+			c.m_loop_range.m_enabled = range.m_enabled;
+			return c;
+		}
+
+		loop_range get_loop_range() const
+		{
+			return loop_range(m_loop_range.m_start_pattern, m_loop_range.m_start_tick, m_loop_range.m_end_pattern, m_loop_range.m_end_tick, m_loop_range.m_enabled);
+		}
+
+		static command set_global_tempo(float tempo)
+		{
+			command c;
+			c.m_type = SET_GLOBAL_TEMPO;
+			c.m_tempo = tempo;
+			return c;
+		}
+
+		static command set_ticks_per_beat(int ticks)
+		{
+			command c;
+			c.m_type = SET_TICKS_PER_BEAT;
+			c.m_ticks = ticks;
+			return c;
+		}
+
+		static command set_transport_source(transport_source source)
+		{
+			command c;
+			c.m_type = SET_TRANSPORT_SOURCE;
+			c.m_transport_source = source;
+			return c;
+		}
+
+		static command set_transport_state(transport_state state)
+		{
+			command c;
+			c.m_type = SET_TRANSPORT_STATE;
+			c.m_transport_state = state;
+			return c;
+		}
+
+		static command set_transport_position(const transport_position &position)
+		{
+			command c;
+			c.m_type = SET_TRANSPORT_POSITION;
+			c.m_transport_position.m_pattern = position.m_pattern;
+			c.m_transport_position.m_tick = position.m_tick;
+			return c;
+		}
+
+		transport_position get_transport_position() const
+		{
+			return transport_position(m_transport_position.m_pattern, m_transport_position.m_tick);
+		}
+
+		static command set_send_all_notes_off_on_loop(bool on)
+		{
+			command c;
+			c.m_type = SET_SEND_ALL_NOTES_OFF_ON_LOOP;
+			c.m_on = on;
+			return c;
+		}
+
+		static command set_send_all_notes_off_on_stop(bool on)
+		{
+			command c;
+			c.m_type = SET_SEND_ALL_NOTES_OFF_ON_STOP;
+			c.m_on = on;
+			return c;
+		}
+
+		static command commit_transaction(const transaction_state *state)
+		{
+			command c;
+			c.m_type = COMMIT_TRANSACTION;
+			c.m_transaction_state = state;
+			return c;
+		}
+	};
+
+	static_assert(std::is_trivially_copyable<command>::value, "commands must be trivially copyable");
+
+	static_assert(sizeof(command) <= 64, "commands must fit into a cache line");
+} // namespace
+
+#endif
@@ -54,20 +54,28 @@ namespace teq
 	
 	struct midi_event
 	{
-		enum type { NONE, ON, OFF, CC, PITCHBEND };
+		enum type { NONE, ON, OFF, CC, PITCHBEND, AFTERTOUCH, CHANNEL_PRESSURE, PROGRAM_CHANGE };
 		
 		type m_type;
 
-		//! ON: midi, OFF: ignored, CC: controller, PITCHBEND: bend
+		//! ON: note, OFF: ignored, CC: controller, PITCHBEND: bend (14 bit, 8192 is the center), AFTERTOUCH: note, CHANNEL_PRESSURE: pressure, PROGRAM_CHANGE: program
 		unsigned m_value1;
 		
-		//! ON: velocity, OFF, CC, PITCHBEND: ignored
+		//! ON: velocity, CC: value, AFTERTOUCH: pressure, all others: ignored
 		unsigned m_value2;
+		
+		/**
+		 * ON: The length of the note in ticks (at the tempo the note
+		 * starts with). Fractions of a tick are fine. 0 lets the note
+		 * sound until the next OFF. All others: ignored.
+		 */
+		float m_length;
 
- 		midi_event(type the_type = type::NONE, unsigned value1 = 0, unsigned value2 = 0) :
+ 		midi_event(type the_type = type::NONE, unsigned value1 = 0, unsigned value2 = 0, float length = 0) :
 			m_type(the_type),
 			m_value1(value1),
-			m_value2(value2)
+			m_value2(value2),
+			m_length(length)
 		{
 			
 		}
@@ -2,7 +2,11 @@
 #define LIBTEQ_HEAP_HH
 
 #include <memory>
-#include <iostream>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 
 namespace teq
 {
@@ -11,29 +15,138 @@ namespace teq
 		virtual void gc() = 0;
 	};
 
+	/**
+	 * Publishes versions of an object to the RT thread RCU style and
+	 * keeps them alive while the RT thread might use them. The RT
+	 * thread only ever holds plain pointers, so it never drops the
+	 * last reference to anything.
+	 *
+	 * The non-RT side publish()es a new version with an atomic
+	 * pointer store and never waits for the RT thread. The RT thread
+	 * picks up the latest() version between enter() and leave() and
+	 * records the version it holds on to with set_in_use() before it
+	 * leave()s. Every enter() and leave() bumps m_epoch, so it is odd
+	 * while the RT thread is in between.
+	 *
+	 * A version that was replaced by a newer one is retired along with
+	 * the epoch at that time. Once the RT thread has left the section
+	 * it was in then (the grace period), it can not pick up that 
+	 * version anymore. gc() then drops the heap's reference unless the
+	 * RT thread still holds on to it.
+	 */
 	template <class T>
 	struct heap : public heap_base
 	{
 		typedef std::shared_ptr<T> T_ptr;
-		
-		std::list<T_ptr> m_heap;
-		
-		T_ptr add(T_ptr ptr)
+
+		struct retired
+		{
+			T_ptr m_ptr;
+
+			uint64_t m_epoch;
+		};
+
+		//! Guards all non-RT state
+		std::mutex m_mutex;
+
+		T_ptr m_latest_ptr;
+
+		std::list<retired> m_retired;
+
+		std::atomic<T*> m_latest;
+
+		std::atomic<uint64_t> m_epoch;
+
+		//! The version the RT thread holds on to
+		std::atomic<const T*> m_in_use;
+
+		heap() :
+			m_latest(0),
+			m_epoch(0),
+			m_in_use(0)
+		{
+
+		}
+
+		T_ptr publish(T_ptr ptr)
 		{
-			m_heap.push_back(ptr);
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_latest.store(ptr.get());
+
+			/**
+			 * Read after the store: If the RT thread enters a period
+			 * after this, it sees the new version.
+			 */
+			const uint64_t epoch = m_epoch.load();
+
+			if (m_latest_ptr)
+			{
+				m_retired.push_back(retired{m_latest_ptr, epoch});
+			}
+
+			m_latest_ptr = ptr;
+
 			return ptr;
 		}
-		
-		T_ptr add_new(T &&t)
+
+		//! RT-safe
+		void enter()
+		{
+			m_epoch.fetch_add(1);
+		}
+
+		//! RT-safe. Only call between enter() and leave()
+		T *latest()
+		{
+			return m_latest.load();
+		}
+
+		//! RT-safe. Only call between enter() and leave()
+		void set_in_use(const T *ptr)
+		{
+			m_in_use.store(ptr, std::memory_order_release);
+		}
+
+		//! RT-safe
+		void leave()
 		{
-			return add(std::make_shared<T>(t));
+			m_epoch.fetch_add(1, std::memory_order_release);
 		}
-		
+
+		/**
+		 * Drops the references to all retired versions whose grace
+		 * period is over. Versions that are not referenced anywhere
+		 * else are destroyed right here.
+		 */
 		virtual void gc() override
 		{
-			m_heap.remove_if(std::mem_fun_ref(&T_ptr::unique));
+			// Destroyed after the lock is released
+			std::vector<T_ptr> garbage;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				const uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+
+				const T *in_use = m_in_use.load(std::memory_order_acquire);
+
+				for (auto it = m_retired.begin(); it != m_retired.end();)
+				{
+					const uint64_t end_of_grace_period = it->m_epoch + (it->m_epoch & 1);
+
+					if (epoch >= end_of_grace_period && it->m_ptr.get() != in_use)
+					{
+						garbage.push_back(it->m_ptr);
+						it = m_retired.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+			}
 		}
 	};
 } // namespace
 #endif
-
@@ -0,0 +1,160 @@
+#include <teq/jack_backend.h>
+#include <teq/exception.h>
+
+#include <sstream>
+#include <stdexcept>
+
+#include <jack/midiport.h>
+
+namespace teq
+{
+	jack_backend::jack_backend(const std::string &client_name)
+	{
+		jack_status_t status;
+		m_jack_client = jack_client_open(client_name.c_str(), JackNullOption, &status);
+
+		if (0 == m_jack_client)
+		{
+			throw std::runtime_error("Failed to open jack client");
+		}
+	}
+
+	jack_backend::~jack_backend()
+	{
+		jack_client_close(m_jack_client);
+	}
+
+	bool jack_backend::is_clocked_manually() const
+	{
+		return false;
+	}
+
+	void jack_backend::set_process_callback(process_callback callback, void *arg)
+	{
+		if (0 != jack_set_process_callback(m_jack_client, callback, arg))
+		{
+			throw std::runtime_error("Failed to set jack process callback");
+		}
+	}
+
+	void jack_backend::activate()
+	{
+		if (0 != jack_activate(m_jack_client))
+		{
+			throw std::runtime_error("Failed to activate jack client");
+		}
+	}
+
+	void jack_backend::deactivate()
+	{
+		jack_deactivate(m_jack_client);
+	}
+
+	backend::port *jack_backend::register_port(const std::string &name, port_type type)
+	{
+		jack_port_t *the_port = 0;
+
+		switch (type)
+		{
+			case port_type::MIDI_OUTPUT:
+				the_port = jack_port_register(m_jack_client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput | JackPortIsTerminal, 0);
+				break;
+
+			case port_type::MIDI_INPUT:
+				the_port = jack_port_register(m_jack_client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput | JackPortIsTerminal, 0);
+				break;
+
+			case port_type::AUDIO_OUTPUT:
+				the_port = jack_port_register(m_jack_client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput | JackPortIsTerminal, 0);
+				break;
+		}
+
+		if (0 == the_port)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to register jack port: " << name)
+		}
+
+		m_ports.push_back(jack_backend_port(the_port));
+
+		return &m_ports.back();
+	}
+
+	void jack_backend::rename_port(port *the_port, const std::string &name)
+	{
+		if (0 != jack_port_rename(m_jack_client, ((jack_backend_port*)the_port)->m_port, name.c_str()))
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to rename jack port to: " << name)
+		}
+	}
+
+	void jack_backend::unregister_port(port *the_port)
+	{
+		jack_port_unregister(m_jack_client, ((jack_backend_port*)the_port)->m_port);
+
+		m_ports.remove_if([the_port](const jack_backend_port &it) { return &it == the_port; });
+	}
+
+	void *jack_backend::get_buffer(port *the_port, nframes_t nframes)
+	{
+		return jack_port_get_buffer(((jack_backend_port*)the_port)->m_port, nframes);
+	}
+
+	void jack_backend::clear_midi_buffer(void *port_buffer)
+	{
+		jack_midi_clear_buffer(port_buffer);
+	}
+
+	unsigned char *jack_backend::reserve_midi_event(void *port_buffer, nframes_t time, size_t size)
+	{
+		return jack_midi_event_reserve(port_buffer, time, size);
+	}
+
+	uint32_t jack_backend::get_midi_event_count(void *port_buffer)
+	{
+		return jack_midi_get_event_count(port_buffer);
+	}
+
+	bool jack_backend::get_midi_event(void *port_buffer, uint32_t index, midi_input_event &event)
+	{
+		jack_midi_event_t jack_event;
+
+		if (0 != jack_midi_event_get(&jack_event, port_buffer, index))
+		{
+			return false;
+		}
+
+		event.m_time = jack_event.time;
+		event.m_size = jack_event.size;
+		event.m_data = jack_event.buffer;
+
+		return true;
+	}
+
+	nframes_t jack_backend::last_frame_time()
+	{
+		return jack_last_frame_time(m_jack_client);
+	}
+
+	nframes_t jack_backend::sample_rate()
+	{
+		return jack_get_sample_rate(m_jack_client);
+	}
+
+	backend::transport_info jack_backend::query_transport()
+	{
+		jack_position_t jack_position;
+
+		transport_info info;
+
+		info.m_rolling = (JackTransportRolling == jack_transport_query(m_jack_client, &jack_position));
+		info.m_frame = jack_position.frame;
+		info.m_has_beats_per_minute = (0 != (jack_position.valid & JackPositionBBT));
+
+		if (true == info.m_has_beats_per_minute)
+		{
+			info.m_beats_per_minute = jack_position.beats_per_minute;
+		}
+
+		return info;
+	}
+} // namespace
@@ -0,0 +1,71 @@
+#ifndef LIBTEQ_JACK_BACKEND_HH
+#define LIBTEQ_JACK_BACKEND_HH
+
+#include <list>
+#include <string>
+
+#include <jack/jack.h>
+
+#include <teq/backend.h>
+
+namespace teq
+{
+	struct jack_backend : backend
+	{
+		struct jack_backend_port : port
+		{
+			jack_port_t *m_port;
+
+			jack_backend_port(jack_port_t *the_port) :
+				m_port(the_port)
+			{
+
+			}
+		};
+
+	protected:
+		jack_client_t *m_jack_client;
+
+		std::list<jack_backend_port> m_ports;
+
+	public:
+		/**
+		 * Opens the jack client. Throws if that fails.
+		 */
+		jack_backend(const std::string &client_name);
+
+		~jack_backend();
+
+		virtual bool is_clocked_manually() const override;
+
+		virtual void set_process_callback(process_callback callback, void *arg) override;
+
+		virtual void activate() override;
+
+		virtual void deactivate() override;
+
+		virtual port *register_port(const std::string &name, port_type type) override;
+
+		virtual void rename_port(port *the_port, const std::string &name) override;
+
+		virtual void unregister_port(port *the_port) override;
+
+		virtual void *get_buffer(port *the_port, nframes_t nframes) override;
+
+		virtual void clear_midi_buffer(void *port_buffer) override;
+
+		virtual unsigned char *reserve_midi_event(void *port_buffer, nframes_t time, size_t size) override;
+
+		virtual uint32_t get_midi_event_count(void *port_buffer) override;
+
+		virtual bool get_midi_event(void *port_buffer, uint32_t index, midi_input_event &event) override;
+
+		virtual nframes_t last_frame_time() override;
+
+		virtual nframes_t sample_rate() override;
+
+		virtual transport_info query_transport() override;
+	};
+} // namespace
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef LIBTEQ_KERNELS_HH
+#define LIBTEQ_KERNELS_HH
+
+#include <teq/backend.h>
+
+namespace teq
+{
+	/**
+	 * Block kernels used to render CV port buffers. They are written
+	 * as plain loops without dependencies between iterations so the
+	 * compiler vectorizes them (we compile with -O3 -march=native).
+	 */
+	namespace kernels
+	{
+		inline void fill(float * __restrict__ buffer, nframes_t nframes, float value)
+		{
+			for (nframes_t index = 0; index < nframes; ++index)
+			{
+				buffer[index] = value;
+			}
+		}
+
+		/**
+		 * buffer[index] = start + index * increment
+		 */
+		inline void ramp(float * __restrict__ buffer, nframes_t nframes, float start, float increment)
+		{
+			for (nframes_t index = 0; index < nframes; ++index)
+			{
+				buffer[index] = start + (float)index * increment;
+			}
+		}
+	} // namespace
+} // namespace
+
+#endif
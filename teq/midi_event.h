@@ -1,169 +1,124 @@
 #ifndef LIBTEQ_MIDI_EVENTS_HH
 #define LIBTEQ_MIDI_EVENTS_HH
 
-#include <memory>
+#include <cstddef>
 
-/* Binary constant generator macro
-By Tom Torfs - donated to the public domain
-*/
+namespace teq
+{
+	namespace midi
+	{
+		/**
+		 * A rendered channel voice message. All encoders below are
+		 * constexpr and non-virtual, so rendering a message boils
+		 * down to a couple of byte stores.
+		 */
+		struct message
+		{
+			unsigned char m_data[3];
 
-/* All macro's evaluate to compile-time constants */
+			unsigned char m_size;
+		};
 
-/* turn a numeric literal into a hex constant
-(avoids problems with leading zeroes)
-8-bit constants max value 0x11111111, always fits in unsigned long
-*/
-#define HEX__(n) 0x##n##LU
+		enum status
+		{
+			NOTE_OFF = 0x80,
+			NOTE_ON = 0x90,
+			POLYPHONIC_AFTERTOUCH = 0xa0,
+			CONTROL_CHANGE = 0xb0,
+			PROGRAM_CHANGE = 0xc0,
+			CHANNEL_PRESSURE = 0xd0,
+			PITCH_BEND = 0xe0
+		};
 
-/* 8-bit conversion function */
-#define B8__(x) ((x&0x0000000FLU)?1:0) \
-+((x&0x000000F0LU)?2:0) \
-+((x&0x00000F00LU)?4:0) \
-+((x&0x0000F000LU)?8:0) \
-+((x&0x000F0000LU)?16:0) \
-+((x&0x00F00000LU)?32:0) \
-+((x&0x0F000000LU)?64:0) \
-+((x&0xF0000000LU)?128:0)
+		constexpr message three_byte_message(status the_status, unsigned char channel, unsigned char data1, unsigned char data2)
+		{
+			return message{{(unsigned char)(the_status | (channel & 0x0f)), (unsigned char)(data1 & 0x7f), (unsigned char)(data2 & 0x7f)}, 3};
+		}
 
-/* *** user macros *** */
+		constexpr message two_byte_message(status the_status, unsigned char channel, unsigned char data1)
+		{
+			return message{{(unsigned char)(the_status | (channel & 0x0f)), (unsigned char)(data1 & 0x7f), 0}, 2};
+		}
 
-/* for upto 8-bit binary constants */
-#define B8(d) ((unsigned char)B8__(HEX__(d)))
+		constexpr message note_on(unsigned char channel, unsigned char note, unsigned char velocity)
+		{
+			return three_byte_message(NOTE_ON, channel, note, velocity);
+		}
 
-/* for upto 16-bit binary constants, MSB first */
-#define B16(dmsb,dlsb) (((unsigned short)B8(dmsb)<< \
-+ B8(dlsb))
+		constexpr message note_off(unsigned char channel, unsigned char note, unsigned char velocity)
+		{
+			return three_byte_message(NOTE_OFF, channel, note, velocity);
+		}
 
-/* for upto 32-bit binary constants, MSB first */
-#define B32(dmsb,db2,db3,dlsb) (((unsigned long)B8(dmsb)<<24) \
-+ ((unsigned long)B8(db2)<<16) \
-+ ((unsigned long)B8(db3)<< \
-+ B8(dlsb))
+		constexpr message cc(unsigned char channel, unsigned char controller, unsigned char value)
+		{
+			return three_byte_message(CONTROL_CHANGE, channel, controller, value);
+		}
 
-namespace teq
-{
-	namespace midi
-	{
-		struct midi_event
+		constexpr message all_notes_off(unsigned char channel)
 		{
-			virtual unsigned size() const = 0;
-			
-			virtual void render(unsigned char *buffer) const = 0;
-			
-			virtual ~midi_event() 
-			{
-				
-			}
-		};
-		
-		typedef std::shared_ptr<midi_event> midi_event_ptr;
-		
-		struct midi_channel_event : midi_event
+			return cc(channel, 123, 0);
+		}
+
+		//! bend is a 14 bit value. 8192 is the center
+		constexpr message pitch_bend(unsigned char channel, unsigned bend)
 		{
-			protected:
-				unsigned char m_channel;
-				
-			public:
-				midi_channel_event(unsigned char channel) :
-					m_channel(channel)
-				{
-					
-				}
-		};
-		
-		struct midi_note_on_event : midi_channel_event
+			return three_byte_message(PITCH_BEND, channel, (unsigned char)(bend & 0x7f), (unsigned char)((bend >> 7) & 0x7f));
+		}
+
+		constexpr message polyphonic_aftertouch(unsigned char channel, unsigned char note, unsigned char pressure)
 		{
-			protected:
-				unsigned char m_note;
-				
-				unsigned char m_velocity;
-				
-			public:
-				midi_note_on_event(unsigned char channel, unsigned char note, unsigned char velocity) :
-					midi_channel_event(channel),
-					m_note(note),
-					m_velocity(velocity)
-				{
-					
-				}
-				
-				virtual unsigned size() const
-				{
-					return 3;
-				}
-				
-				virtual void render(unsigned char *buffer) const
-				{
-					buffer[0] = B8(10010000) | m_channel;
-					buffer[1] = m_note;
-					buffer[2] = m_velocity;
-				}
-		};
-		
-		struct midi_note_off_event : midi_channel_event
+			return three_byte_message(POLYPHONIC_AFTERTOUCH, channel, note, pressure);
+		}
+
+		constexpr message channel_pressure(unsigned char channel, unsigned char pressure)
 		{
-			protected:
-				unsigned char m_note;
-				
-				unsigned char m_velocity;
-				
-			public:
-				midi_note_off_event(unsigned char channel, unsigned char note, unsigned char velocity) :
-					midi_channel_event(channel),
-					m_note(note),
-					m_velocity(velocity)
-				{
-					
-				}
-				
-				virtual unsigned size() const
-				{
-					return 3;
-				}
-				
-				virtual void render(unsigned char *buffer) const
-				{
-					buffer[0] = B8(10000000) | m_channel;
-					buffer[1] = m_note;
-					buffer[2] = m_velocity;
-				}
-		};
-		
-		struct midi_cc_event : midi_channel_event
+			return two_byte_message(CHANNEL_PRESSURE, channel, pressure);
+		}
+
+		constexpr message program_change(unsigned char channel, unsigned char program)
 		{
-			protected:
-				unsigned char m_cc;
-				
-				unsigned char m_value;
-				
-			public:
-				midi_cc_event(unsigned char channel, unsigned char cc, unsigned char value) :
-					midi_channel_event(channel),
-					m_cc(cc),
-					m_value(value)
-				{
-					
-				}
-				
-				virtual unsigned size() const
-				{
-					return 3;
-				}
-				
-				virtual void render(unsigned char *buffer) const 
-				{
-					buffer[0] = B8(10110000) | m_channel;
-					buffer[1] = m_cc;
-					buffer[2] = m_value;
-				}
-		};
-		
-		struct midi_all_notes_off_event : midi_cc_event
+			return two_byte_message(PROGRAM_CHANGE, channel, program);
+		}
+
+		//! The same message on a different channel
+		constexpr message with_channel(const message &the_message, unsigned char channel)
+		{
+			return message{{(unsigned char)((the_message.m_data[0] & 0xf0) | (channel & 0x0f)), the_message.m_data[1], the_message.m_data[2]}, the_message.m_size};
+		}
+
+		/**
+		 * A fixed capacity batch of messages that all go out on the
+		 * same port at the same frame. Lives on the stack of the RT
+		 * thread.
+		 */
+		template<size_t Capacity>
+		struct message_batch
 		{
-			midi_all_notes_off_event(unsigned char channel) :
-				midi_cc_event(channel, 123, 0)
+			message m_messages[Capacity];
+
+			size_t m_size;
+
+			message_batch() :
+				m_size(0)
+			{
+
+			}
+
+			bool full() const
+			{
+				return Capacity == m_size;
+			}
+
+			void push_back(const message &the_message)
+			{
+				m_messages[m_size] = the_message;
+				++m_size;
+			}
+
+			void clear()
 			{
-				
+				m_size = 0;
 			}
 		};
 	} // namespace
@@ -0,0 +1,182 @@
+#ifndef LIBTEQ_NOTE_OFF_QUEUE_HH
+#define LIBTEQ_NOTE_OFF_QUEUE_HH
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include <teq/backend.h>
+
+namespace teq
+{
+	/**
+	 * The note offs of notes with a length (see midi_event::m_length)
+	 * that are still to be sent, ordered by frame. A binary min-heap
+	 * in storage allocated up front, so all operations are RT-safe.
+	 */
+	struct note_off_queue
+	{
+		struct entry
+		{
+			//! The frame to send the note off on, counted like teq::m_period_start_frame
+			int64_t m_frame;
+
+			//! The port of the track that played the note
+			backend::port *m_port;
+
+			unsigned char m_channel;
+
+			//! The channel of the note on the multi port
+			unsigned char m_multi_channel;
+
+			unsigned char m_note;
+		};
+
+		std::vector<entry> m_entries;
+
+		size_t m_size;
+
+		note_off_queue(size_t capacity) :
+			m_entries(capacity),
+			m_size(0)
+		{
+
+		}
+
+		bool empty() const
+		{
+			return 0 == m_size;
+		}
+
+		bool full() const
+		{
+			return m_entries.size() == m_size;
+		}
+
+		size_t size() const
+		{
+			return m_size;
+		}
+
+		//! The entry with the earliest frame
+		const entry &top() const
+		{
+			return m_entries[0];
+		}
+
+		//! Only call if not full()
+		void push(const entry &the_entry)
+		{
+			m_entries[m_size] = the_entry;
+			++m_size;
+
+			sift_up(m_size - 1);
+		}
+
+		void clear()
+		{
+			m_size = 0;
+		}
+
+		void pop()
+		{
+			remove(0);
+		}
+
+		//! Removes the entry at index, which is any index below size()
+		void remove(size_t index)
+		{
+			--m_size;
+
+			if (index == m_size)
+			{
+				return;
+			}
+
+			m_entries[index] = m_entries[m_size];
+
+			sift_up(index);
+			sift_down(index);
+		}
+
+		/**
+		 * The index of the entry for the note on channel of port or
+		 * -1. O(size()).
+		 */
+		int find(const backend::port *the_port, unsigned char channel, unsigned char note) const
+		{
+			for (size_t index = 0; index < m_size; ++index)
+			{
+				const entry &the_entry = m_entries[index];
+
+				if (the_entry.m_port == the_port && the_entry.m_channel == channel && the_entry.m_note == note)
+				{
+					return (int)index;
+				}
+			}
+
+			return -1;
+		}
+
+		/**
+		 * Moves all note offs later than frame to frame. This keeps the
+		 * heap ordered, so it is O(size()).
+		 */
+		void cut_at(int64_t frame)
+		{
+			for (size_t index = 0; index < m_size; ++index)
+			{
+				m_entries[index].m_frame = std::min(m_entries[index].m_frame, frame);
+			}
+		}
+
+	protected:
+		void sift_up(size_t index)
+		{
+			while (index > 0)
+			{
+				const size_t parent = (index - 1) / 2;
+
+				if (m_entries[parent].m_frame <= m_entries[index].m_frame)
+				{
+					return;
+				}
+
+				std::swap(m_entries[parent], m_entries[index]);
+				index = parent;
+			}
+		}
+
+		void sift_down(size_t index)
+		{
+			while (true)
+			{
+				const size_t left = 2 * index + 1;
+				const size_t right = left + 1;
+
+				size_t smallest = index;
+
+				if (left < m_size && m_entries[left].m_frame < m_entries[smallest].m_frame)
+				{
+					smallest = left;
+				}
+
+				if (right < m_size && m_entries[right].m_frame < m_entries[smallest].m_frame)
+				{
+					smallest = right;
+				}
+
+				if (smallest == index)
+				{
+					return;
+				}
+
+				std::swap(m_entries[smallest], m_entries[index]);
+				index = smallest;
+			}
+		}
+	};
+} // namespace
+
+#endif
@@ -0,0 +1,226 @@
+#include <teq/null_backend.h>
+#include <teq/exception.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace teq
+{
+	null_backend::null_backend(nframes_t sample_rate, nframes_t buffer_size, size_t midi_buffer_capacity) :
+		m_sample_rate(sample_rate),
+		m_buffer_size(buffer_size),
+		m_midi_buffer_capacity(midi_buffer_capacity),
+		m_process_callback(0),
+		m_process_callback_arg(0),
+		m_active(false),
+		m_frame_time(0)
+	{
+
+	}
+
+	void null_backend::run(nframes_t nframes)
+	{
+		if (nframes > m_buffer_size)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Period size exceeds the buffer size: " << nframes << " > " << m_buffer_size)
+		}
+
+		if (false == m_active || 0 == m_process_callback)
+		{
+			return;
+		}
+
+		m_process_callback(nframes, m_process_callback_arg);
+
+		for (auto &the_port : m_ports)
+		{
+			if (port_type::MIDI_INPUT == the_port.m_type)
+			{
+				the_port.m_midi_buffer.m_number_of_events = 0;
+			}
+		}
+
+		m_frame_time += nframes;
+
+		if (true == m_transport.m_rolling)
+		{
+			m_transport.m_frame += nframes;
+		}
+	}
+
+	void null_backend::set_sample_rate(nframes_t sample_rate)
+	{
+		m_sample_rate = sample_rate;
+	}
+
+	void null_backend::set_buffer_size(nframes_t buffer_size)
+	{
+		m_buffer_size = buffer_size;
+
+		for (auto &the_port : m_ports)
+		{
+			the_port.m_audio_buffer.resize(buffer_size, 0);
+		}
+	}
+
+	nframes_t null_backend::buffer_size() const
+	{
+		return m_buffer_size;
+	}
+
+	void null_backend::set_transport(const transport_info &info)
+	{
+		m_transport = info;
+	}
+
+	null_backend::null_port *null_backend::find_port(const std::string &name)
+	{
+		for (auto &the_port : m_ports)
+		{
+			if (name == the_port.m_name)
+			{
+				return &the_port;
+			}
+		}
+
+		return 0;
+	}
+
+	bool null_backend::write_midi_input_event(port *the_port, nframes_t time, const unsigned char *data, size_t size)
+	{
+		midi_buffer &buffer = ((null_port*)the_port)->m_midi_buffer;
+
+		unsigned char *event_buffer = reserve_midi_event(&buffer, time, size);
+
+		if (0 == event_buffer)
+		{
+			return false;
+		}
+
+		for (size_t index = 0; index < size; ++index)
+		{
+			event_buffer[index] = data[index];
+		}
+
+		return true;
+	}
+
+	bool null_backend::is_clocked_manually() const
+	{
+		return true;
+	}
+
+	void null_backend::set_process_callback(process_callback callback, void *arg)
+	{
+		m_process_callback = callback;
+		m_process_callback_arg = arg;
+	}
+
+	void null_backend::activate()
+	{
+		m_active = true;
+	}
+
+	void null_backend::deactivate()
+	{
+		m_active = false;
+	}
+
+	backend::port *null_backend::register_port(const std::string &name, port_type type)
+	{
+		if (0 != find_port(name))
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Port name already exists: " << name)
+		}
+
+		m_ports.push_back(null_port(name, type, m_midi_buffer_capacity, m_buffer_size));
+
+		return &m_ports.back();
+	}
+
+	void null_backend::rename_port(port *the_port, const std::string &name)
+	{
+		if (0 != find_port(name))
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Port name already exists: " << name)
+		}
+
+		((null_port*)the_port)->m_name = name;
+	}
+
+	void null_backend::unregister_port(port *the_port)
+	{
+		m_ports.remove_if([the_port](const null_port &it) { return &it == the_port; });
+	}
+
+	void *null_backend::get_buffer(port *the_port, nframes_t nframes)
+	{
+		null_port &the_null_port = *((null_port*)the_port);
+
+		if (port_type::AUDIO_OUTPUT == the_null_port.m_type)
+		{
+			return &the_null_port.m_audio_buffer[0];
+		}
+
+		return &the_null_port.m_midi_buffer;
+	}
+
+	void null_backend::clear_midi_buffer(void *port_buffer)
+	{
+		((midi_buffer*)port_buffer)->m_number_of_events = 0;
+	}
+
+	unsigned char *null_backend::reserve_midi_event(void *port_buffer, nframes_t time, size_t size)
+	{
+		midi_buffer &buffer = *((midi_buffer*)port_buffer);
+
+		if (buffer.m_number_of_events >= buffer.m_events.size() || size > sizeof(midi_buffer::event::m_data))
+		{
+			return 0;
+		}
+
+		midi_buffer::event &the_event = buffer.m_events[buffer.m_number_of_events];
+		++buffer.m_number_of_events;
+
+		the_event.m_time = time;
+		the_event.m_size = size;
+
+		return the_event.m_data;
+	}
+
+	uint32_t null_backend::get_midi_event_count(void *port_buffer)
+	{
+		return ((midi_buffer*)port_buffer)->m_number_of_events;
+	}
+
+	bool null_backend::get_midi_event(void *port_buffer, uint32_t index, midi_input_event &event)
+	{
+		midi_buffer &buffer = *((midi_buffer*)port_buffer);
+
+		if (index >= buffer.m_number_of_events)
+		{
+			return false;
+		}
+
+		event.m_time = buffer.m_events[index].m_time;
+		event.m_size = buffer.m_events[index].m_size;
+		event.m_data = buffer.m_events[index].m_data;
+
+		return true;
+	}
+
+	nframes_t null_backend::last_frame_time()
+	{
+		return m_frame_time;
+	}
+
+	nframes_t null_backend::sample_rate()
+	{
+		return m_sample_rate;
+	}
+
+	backend::transport_info null_backend::query_transport()
+	{
+		return m_transport;
+	}
+} // namespace
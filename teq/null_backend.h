@@ -0,0 +1,153 @@
+#ifndef LIBTEQ_NULL_BACKEND_HH
+#define LIBTEQ_NULL_BACKEND_HH
+
+#include <list>
+#include <vector>
+#include <string>
+
+#include <teq/backend.h>
+
+namespace teq
+{
+	/**
+	 * An in-memory backend that needs no audio server. It is clocked
+	 * manually by calling run() which calls the process callback
+	 * exactly like jack would. After run() returned, the output port
+	 * buffers hold what the engine wrote during that period.
+	 *
+	 * NOTE: Since commands are executed right away on manually clocked
+	 * backends (see backend::is_clocked_manually()), run() must be
+	 * called from the same thread that edits the song.
+	 */
+	struct null_backend : backend
+	{
+		struct midi_buffer
+		{
+			struct event
+			{
+				nframes_t m_time;
+
+				unsigned char m_data[3];
+
+				size_t m_size;
+			};
+
+			//! Preallocated, only the first m_number_of_events are valid
+			std::vector<event> m_events;
+
+			uint32_t m_number_of_events;
+
+			midi_buffer(size_t capacity) :
+				m_events(capacity),
+				m_number_of_events(0)
+			{
+
+			}
+		};
+
+		struct null_port : port
+		{
+			std::string m_name;
+
+			port_type m_type;
+
+			midi_buffer m_midi_buffer;
+
+			std::vector<float> m_audio_buffer;
+
+			null_port(const std::string &name, port_type type, size_t midi_buffer_capacity, nframes_t buffer_size) :
+				m_name(name),
+				m_type(type),
+				m_midi_buffer(midi_buffer_capacity),
+				m_audio_buffer(buffer_size, 0)
+			{
+
+			}
+		};
+
+	protected:
+		nframes_t m_sample_rate;
+
+		nframes_t m_buffer_size;
+
+		size_t m_midi_buffer_capacity;
+
+		std::list<null_port> m_ports;
+
+		process_callback m_process_callback;
+
+		void *m_process_callback_arg;
+
+		bool m_active;
+
+		nframes_t m_frame_time;
+
+		transport_info m_transport;
+
+	public:
+		null_backend(nframes_t sample_rate = 48000, nframes_t buffer_size = 1024, size_t midi_buffer_capacity = 1024);
+
+		/**
+		 * Run one period of nframes frames. nframes must not be larger
+		 * than the buffer size. Does nothing if the backend is not
+		 * active.
+		 */
+		void run(nframes_t nframes);
+
+		void set_sample_rate(nframes_t sample_rate);
+
+		/**
+		 * Resizes all port buffers. Not RT-safe.
+		 */
+		void set_buffer_size(nframes_t buffer_size);
+
+		nframes_t buffer_size() const;
+
+		/**
+		 * Set the state reported by query_transport(). While rolling
+		 * the transport frame advances with every run().
+		 */
+		void set_transport(const transport_info &info);
+
+		//! Returns 0 if no port with that name exists
+		null_port *find_port(const std::string &name);
+
+		/**
+		 * Queue an event on a MIDI_INPUT port for the next run(). The
+		 * input buffers are cleared after each run().
+		 */
+		bool write_midi_input_event(port *the_port, nframes_t time, const unsigned char *data, size_t size);
+
+		virtual bool is_clocked_manually() const override;
+
+		virtual void set_process_callback(process_callback callback, void *arg) override;
+
+		virtual void activate() override;
+
+		virtual void deactivate() override;
+
+		virtual port *register_port(const std::string &name, port_type type) override;
+
+		virtual void rename_port(port *the_port, const std::string &name) override;
+
+		virtual void unregister_port(port *the_port) override;
+
+		virtual void *get_buffer(port *the_port, nframes_t nframes) override;
+
+		virtual void clear_midi_buffer(void *port_buffer) override;
+
+		virtual unsigned char *reserve_midi_event(void *port_buffer, nframes_t time, size_t size) override;
+
+		virtual uint32_t get_midi_event_count(void *port_buffer) override;
+
+		virtual bool get_midi_event(void *port_buffer, uint32_t index, midi_input_event &event) override;
+
+		virtual nframes_t last_frame_time() override;
+
+		virtual nframes_t sample_rate() override;
+
+		virtual transport_info query_transport() override;
+	};
+} // namespace
+
+#endif
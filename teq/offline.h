@@ -0,0 +1,255 @@
+#ifndef LIBTEQ_OFFLINE_HH
+#define LIBTEQ_OFFLINE_HH
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <teq/exception.h>
+
+namespace teq
+{
+	/**
+	 * Collects the midi events of one port over a whole offline
+	 * render. Events are stored with their absolute frame time.
+	 */
+	struct offline_midi_buffer
+	{
+		struct event
+		{
+			uint64_t m_frame;
+
+			unsigned char m_data[3];
+
+			unsigned m_size;
+		};
+
+		std::vector<event> m_events;
+
+		void write(uint64_t frame, const unsigned char *data, size_t size)
+		{
+			event the_event;
+
+			the_event.m_frame = frame;
+			the_event.m_size = (unsigned)size;
+
+			if (size > sizeof(the_event.m_data))
+			{
+				return;
+			}
+
+			std::memcpy(the_event.m_data, data, size);
+
+			m_events.push_back(the_event);
+		}
+	};
+
+	//! For internal use only!
+	inline void write_little_endian(std::ostream &stream, uint32_t value, unsigned bytes)
+	{
+		for (unsigned index = 0; index < bytes; ++index)
+		{
+			stream.put((char)((value >> (8 * index)) & 0xff));
+		}
+	}
+
+	//! For internal use only!
+	inline void write_big_endian(std::ostream &stream, uint32_t value, unsigned bytes)
+	{
+		for (unsigned index = bytes; index > 0; --index)
+		{
+			stream.put((char)((value >> (8 * (index - 1))) & 0xff));
+		}
+	}
+
+	//! For internal use only!
+	inline void write_variable_length_quantity(std::ostream &stream, uint32_t value)
+	{
+		unsigned char bytes[5];
+		unsigned number_of_bytes = 0;
+
+		do
+		{
+			bytes[number_of_bytes] = (unsigned char)(value & 0x7f);
+			value >>= 7;
+			++number_of_bytes;
+		}
+		while (0 != value);
+
+		for (unsigned index = number_of_bytes; index > 0; --index)
+		{
+			stream.put((char)(bytes[index - 1] | (index > 1 ? 0x80 : 0x00)));
+		}
+	}
+
+	/**
+	 * Write a format 1 standard midi file. The first track only holds
+	 * the tempo. Every entry of tracks becomes one further track named
+	 * after the first member of the pair.
+	 *
+	 * The frame times of the events are converted to midi file ticks using
+	 * a single constant tempo of beats_per_second. Since the conversion is
+	 * purely time based, tempo changes during the song still end up at
+	 * the right place in time.
+	 */
+	inline void write_smf
+	(
+		const std::string &file_name,
+		const std::vector<std::pair<std::string, const offline_midi_buffer*>> &tracks,
+		double sample_rate,
+		double beats_per_second
+	)
+	{
+		const uint32_t ticks_per_quarter = 960;
+
+		double microseconds_per_quarter = 1000000.0 / beats_per_second;
+
+		if (microseconds_per_quarter < 1.0)
+		{
+			microseconds_per_quarter = 1.0;
+		}
+
+		if (microseconds_per_quarter > (double)0xffffff)
+		{
+			microseconds_per_quarter = (double)0xffffff;
+		}
+
+		const double smf_ticks_per_frame = (1000000.0 / microseconds_per_quarter) * ticks_per_quarter / sample_rate;
+
+		std::ofstream stream(file_name.c_str(), std::ios::binary);
+
+		if (false == stream.good())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to open midi file for writing: " << file_name)
+		}
+
+		stream.write("MThd", 4);
+		write_big_endian(stream, 6, 4);
+		write_big_endian(stream, 1, 2);
+		write_big_endian(stream, (uint32_t)(tracks.size() + 1), 2);
+		write_big_endian(stream, ticks_per_quarter, 2);
+
+		{
+			std::stringstream chunk;
+
+			write_variable_length_quantity(chunk, 0);
+			chunk.put((char)0xff);
+			chunk.put((char)0x51);
+			chunk.put((char)0x03);
+			write_big_endian(chunk, (uint32_t)microseconds_per_quarter, 3);
+
+			write_variable_length_quantity(chunk, 0);
+			chunk.put((char)0xff);
+			chunk.put((char)0x2f);
+			chunk.put((char)0x00);
+
+			const std::string data = chunk.str();
+			stream.write("MTrk", 4);
+			write_big_endian(stream, (uint32_t)data.size(), 4);
+			stream.write(data.data(), (std::streamsize)data.size());
+		}
+
+		for (auto &track : tracks)
+		{
+			std::stringstream chunk;
+
+			write_variable_length_quantity(chunk, 0);
+			chunk.put((char)0xff);
+			chunk.put((char)0x03);
+			write_variable_length_quantity(chunk, (uint32_t)track.first.size());
+			chunk.write(track.first.data(), (std::streamsize)track.first.size());
+
+			uint32_t last_smf_tick = 0;
+
+			for (auto &event : track.second->m_events)
+			{
+				//! Events out of frame order go out right after the previous one
+				const uint32_t smf_tick = std::max(last_smf_tick, (uint32_t)llround((double)event.m_frame * smf_ticks_per_frame));
+
+				write_variable_length_quantity(chunk, smf_tick - last_smf_tick);
+				chunk.write((const char*)event.m_data, (std::streamsize)event.m_size);
+
+				last_smf_tick = smf_tick;
+			}
+
+			write_variable_length_quantity(chunk, 0);
+			chunk.put((char)0xff);
+			chunk.put((char)0x2f);
+			chunk.put((char)0x00);
+
+			const std::string data = chunk.str();
+			stream.write("MTrk", 4);
+			write_big_endian(stream, (uint32_t)data.size(), 4);
+			stream.write(data.data(), (std::streamsize)data.size());
+		}
+
+		if (false == stream.good())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to write midi file: " << file_name)
+		}
+	}
+
+	/**
+	 * Write a mono 32 bit IEEE float wav file.
+	 */
+	inline void write_wav
+	(
+		const std::string &file_name,
+		const std::vector<float> &samples,
+		uint32_t sample_rate
+	)
+	{
+		std::ofstream stream(file_name.c_str(), std::ios::binary);
+
+		if (false == stream.good())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to open wav file for writing: " << file_name)
+		}
+
+		const uint32_t data_size = (uint32_t)(samples.size() * sizeof(float));
+
+		stream.write("RIFF", 4);
+		write_little_endian(stream, 4 + (8 + 18) + (8 + 4) + (8 + data_size), 4);
+		stream.write("WAVE", 4);
+
+		stream.write("fmt ", 4);
+		write_little_endian(stream, 18, 4);
+		//! WAVE_FORMAT_IEEE_FLOAT
+		write_little_endian(stream, 3, 2);
+		write_little_endian(stream, 1, 2);
+		write_little_endian(stream, sample_rate, 4);
+		write_little_endian(stream, sample_rate * (uint32_t)sizeof(float), 4);
+		write_little_endian(stream, (uint32_t)sizeof(float), 2);
+		write_little_endian(stream, 8 * (uint32_t)sizeof(float), 2);
+		write_little_endian(stream, 0, 2);
+
+		stream.write("fact", 4);
+		write_little_endian(stream, 4, 4);
+		write_little_endian(stream, (uint32_t)samples.size(), 4);
+
+		stream.write("data", 4);
+		write_little_endian(stream, data_size, 4);
+
+		for (auto sample : samples)
+		{
+			uint32_t bits;
+			static_assert(sizeof(bits) == sizeof(sample), "float must be 32 bits wide");
+			std::memcpy(&bits, &sample, sizeof(bits));
+			write_little_endian(stream, bits, 4);
+		}
+
+		if (false == stream.good())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Failed to write wav file: " << file_name)
+		}
+	}
+} // namespace
+
+#endif
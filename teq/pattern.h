@@ -32,6 +32,22 @@ namespace teq
 			}
 		}
 
+		/**
+		 * A copy that shares the sequences with this pattern. Replace
+		 * a sequence with a clone before modifying it (see
+		 * teq::transaction::set_event()).
+		 */
+		std::shared_ptr<pattern> copy_sharing_sequences() const
+		{
+			std::shared_ptr<pattern> the_copy(new pattern(m_length));
+
+			the_copy->m_name = m_name;
+			the_copy->m_muted = m_muted;
+			the_copy->m_sequences = m_sequences;
+
+			return the_copy;
+		}
+
 		typedef std::vector<sequence_ptr> sequence_list;
 		
 		sequence_list m_sequences;
@@ -62,6 +78,14 @@ namespace teq
 			}
 		}
 		
+		void check_tick_range(int first_tick, int number_of_ticks) const
+		{
+			if (first_tick < 0 || number_of_ticks < 0 || first_tick > length() - number_of_ticks)
+			{
+				LIBTEQ_THROW_RUNTIME_ERROR("tick range out of range: " << first_tick << " + " << number_of_ticks << " > " << length())
+			}
+		}
+		
 		void check_track_index(int the_track) const
 		{
 			if (the_track < 0 || the_track >= (int)m_sequences.size())
@@ -70,48 +94,191 @@ namespace teq
 			}
 		}
 		
+		//! The number of note columns of a track (see midi_track::m_number_of_columns)
+		int number_of_columns(int track_index) const
+		{
+			check_track_index(track_index);
+			
+			if (auto columns = dynamic_cast<const column_sequence*>(m_sequences[(size_t)track_index].get()))
+			{
+				return (int)columns->number_of_columns();
+			}
+			
+			return 1;
+		}
+		
+		void check_column_index(int track_index, int column_index) const
+		{
+			if (column_index < 0 || column_index >= number_of_columns(track_index))
+			{
+				LIBTEQ_THROW_RUNTIME_ERROR("column out of range: " << column_index << " >= " << number_of_columns(track_index))
+			}
+		}
+		
+		/**
+		 * The sequence of a column of a track. The methods below that
+		 * take no column work on column 0.
+		 */
+		const sequence_ptr &column(int track_index, int column_index) const
+		{
+			check_column_index(track_index, column_index);
+			
+			const sequence_ptr &the_sequence = m_sequences[(size_t)track_index];
+			
+			if (auto columns = dynamic_cast<const column_sequence*>(the_sequence.get()))
+			{
+				return columns->m_columns[(size_t)column_index];
+			}
+			
+			return the_sequence;
+		}
+		
+		sequence_ptr &column(int track_index, int column_index)
+		{
+			return const_cast<sequence_ptr&>(static_cast<const pattern*>(this)->column(track_index, column_index));
+		}
+		
 		template<class EventType>
-		void set_event
+		void set_column_event
 		(
 			int track_index,
+			int column_index,
 			int tick_index,
 			const EventType &event
 		)
 		{
-			check_track_index(track_index);
+			sequence_ptr &the_column = column(track_index, column_index);
 			
 			check_tick_index(tick_index);
 			
-			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(m_sequences[track_index]);
+			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(the_column);
 			
 			if (!sequence_ptr)
 			{
 				LIBTEQ_THROW_RUNTIME_ERROR("Cast to sequence type failed. Did you try to set a wrong event type?")
 			}
 			
-			sequence_ptr->m_events[tick_index] = event;
+			sequence_ptr->set_event((unsigned)tick_index, event);
+			
+			if (sequence::AUTOMATIC == sequence_ptr->m_storage)
+			{
+				auto adapted_sequence = sequence_ptr->adapt_to_density();
+				
+				if (adapted_sequence)
+				{
+					the_column = adapted_sequence;
+				}
+			}
 		}
-	
 		
 		template<class EventType>
-		EventType get_event
+		EventType get_column_event
 		(
 			int track_index,
+			int column_index,
 			int tick_index
 		) const
 		{
-			check_track_index(track_index);
+			const sequence_ptr &the_column = column(track_index, column_index);
 			
 			check_tick_index(tick_index);
 			
-			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(m_sequences[track_index]);
+			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(the_column);
 			
 			if (!sequence_ptr)
 			{
 				LIBTEQ_THROW_RUNTIME_ERROR("Cast to sequence type failed. Did you try to set a wrong event type?")
 			}
 			
-			return sequence_ptr->m_events[tick_index];
+			return sequence_ptr->get_event((unsigned)tick_index);
+		}
+		
+		template<class EventType>
+		void set_event
+		(
+			int track_index,
+			int tick_index,
+			const EventType &event
+		)
+		{
+			set_column_event(track_index, 0, tick_index, event);
+		}
+		
+		template<class EventType>
+		EventType get_event
+		(
+			int track_index,
+			int tick_index
+		) const
+		{
+			return get_column_event<EventType>(track_index, 0, tick_index);
+		}
+		
+		/**
+		 * Copies the events of the ticks [first_tick, first_tick + number_of_ticks)
+		 * of a column of a track to events in one go.
+		 */
+		template<class EventType>
+		void get_events
+		(
+			int track_index,
+			int first_tick,
+			int number_of_ticks,
+			EventType *events,
+			int column_index = 0
+		) const
+		{
+			const sequence_ptr &the_column = column(track_index, column_index);
+			
+			check_tick_range(first_tick, number_of_ticks);
+			
+			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(the_column);
+			
+			if (!sequence_ptr)
+			{
+				LIBTEQ_THROW_RUNTIME_ERROR("Cast to sequence type failed. Did you try to get a wrong event type?")
+			}
+			
+			sequence_ptr->get_events((unsigned)first_tick, (unsigned)number_of_ticks, events);
+		}
+		
+		/**
+		 * Replaces the events of the ticks [first_tick, first_tick + number_of_ticks)
+		 * of a column of a track in one go. This is a lot faster than
+		 * calling set_event() for each tick.
+		 */
+		template<class EventType>
+		void set_events
+		(
+			int track_index,
+			int first_tick,
+			int number_of_ticks,
+			const EventType *events,
+			int column_index = 0
+		)
+		{
+			sequence_ptr &the_column = column(track_index, column_index);
+			
+			check_tick_range(first_tick, number_of_ticks);
+			
+			auto sequence_ptr = std::dynamic_pointer_cast<sequence_of<EventType>>(the_column);
+			
+			if (!sequence_ptr)
+			{
+				LIBTEQ_THROW_RUNTIME_ERROR("Cast to sequence type failed. Did you try to set a wrong event type?")
+			}
+			
+			sequence_ptr->set_events((unsigned)first_tick, (unsigned)number_of_ticks, events);
+			
+			if (sequence::AUTOMATIC == sequence_ptr->m_storage)
+			{
+				auto adapted_sequence = sequence_ptr->adapt_to_density();
+				
+				if (adapted_sequence)
+				{
+					the_column = adapted_sequence;
+				}
+			}
 		}
 		
 
@@ -0,0 +1,131 @@
+#ifndef LIBTEQ_PERSISTENT_VECTOR_HH
+#define LIBTEQ_PERSISTENT_VECTOR_HH
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
+
+namespace teq
+{
+	/**
+	 * A vector stored in fixed size chunks that are shared between
+	 * copies. Copying and resizing is O(number of chunks) and setting
+	 * an element copies at most the one chunk it lives in (copy on
+	 * write).
+	 *
+	 * Readers that want to go through the elements quickly iterate
+	 * the chunks, each of which is a contiguous array (see chunk_data()).
+	 *
+	 * NOTE: A chunk is modified in place if this vector is its only
+	 * owner, so a vector must not be modified while it is being
+	 * copied.
+	 */
+	template<class T, size_t ChunkSize = 256>
+	struct persistent_vector
+	{
+		static const size_t chunk_size = ChunkSize;
+
+		struct chunk
+		{
+			T m_items[ChunkSize];
+
+			chunk() :
+				m_items()
+			{
+
+			}
+		};
+
+		typedef std::shared_ptr<chunk> chunk_ptr;
+
+		std::vector<chunk_ptr> m_chunks;
+
+		size_t m_size;
+
+		persistent_vector() :
+			m_size(0)
+		{
+
+		}
+
+		size_t size() const
+		{
+			return m_size;
+		}
+
+		size_t number_of_chunks() const
+		{
+			return m_chunks.size();
+		}
+
+		//! The elements [index * chunk_size, (index + 1) * chunk_size)
+		const T *chunk_data(size_t index) const
+		{
+			return m_chunks[index]->m_items;
+		}
+
+		//! Copies the chunk first if it is shared
+		T *mutable_chunk_data(size_t index)
+		{
+			return mutable_chunk(index).m_items;
+		}
+
+		const T &operator[](size_t index) const
+		{
+			return m_chunks[index / ChunkSize]->m_items[index % ChunkSize];
+		}
+
+		void set(size_t index, const T &value)
+		{
+			mutable_chunk(index / ChunkSize).m_items[index % ChunkSize] = value;
+		}
+
+		/**
+		 * New elements are default constructed. Shrinking drops whole
+		 * chunks only, the rest of the last chunk is reset when the
+		 * vector grows again.
+		 */
+		void resize(size_t size)
+		{
+			const size_t old_size = m_size;
+
+			m_chunks.resize((size + ChunkSize - 1) / ChunkSize);
+
+			for (auto &it : m_chunks)
+			{
+				if (!it)
+				{
+					it = chunk_ptr(new chunk);
+				}
+			}
+
+			m_size = size;
+
+			if (size > old_size && 0 != old_size % ChunkSize)
+			{
+				const size_t end = std::min(size, (old_size / ChunkSize + 1) * ChunkSize);
+
+				for (size_t index = old_size; index < end; ++index)
+				{
+					set(index, T());
+				}
+			}
+		}
+
+	protected:
+		chunk &mutable_chunk(size_t index)
+		{
+			chunk_ptr &the_chunk = m_chunks[index];
+
+			if (false == the_chunk.unique())
+			{
+				the_chunk = chunk_ptr(new chunk(*the_chunk));
+			}
+
+			return *the_chunk;
+		}
+	};
+} // namespace
+
+#endif
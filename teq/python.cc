@@ -2,9 +2,354 @@
 
 #include <boost/python.hpp>
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+//! Releases the GIL for its lifetime
+struct gil_release
+{
+	PyThreadState *m_thread_state;
+
+	gil_release() :
+		m_thread_state(PyEval_SaveThread())
+	{
+
+	}
+
+	~gil_release()
+	{
+		PyEval_RestoreThread(m_thread_state);
+	}
+};
+
+/**
+ * Wraps a member function that might block (e.g. waiting for the
+ * process callback or talking to the jack server) so other python
+ * threads keep running meanwhile. Only use it for functions that do
+ * not touch python objects.
+ */
+template<class Function, Function function>
+struct without_gil;
+
+template<class Result, class Class, class... Args, Result (Class::*function)(Args...)>
+struct without_gil<Result (Class::*)(Args...), function>
+{
+	static Result call(Class &object, Args... args)
+	{
+		gil_release release;
+
+		return (object.*function)(args...);
+	}
+};
+
+#define LIBTEQ_WITHOUT_GIL(function) &without_gil<decltype(function), function>::call
+
+/**
+ * Polls the state of a teq every interval_ms milliseconds from a 
+ * thread of its own and calls callback(state_info, tick_events) 
+ * whenever the state changed or there were tick events (see
+ * teq::set_tick_events_enabled()). tick_events is a list of all tick
+ * events since the last call. The callback runs with the GIL held.
+ *
+ * NOTE: While a dispatcher runs, do not read tick events otherwise.
+ */
+struct state_dispatcher
+{
+	teq::teq &m_teq;
+
+	boost::python::object m_callback;
+
+	std::chrono::milliseconds m_interval;
+
+	//! Shared with run() which must not touch the dispatcher after a callback returned
+	std::shared_ptr<std::atomic<bool>> m_stop;
+
+	std::thread m_thread;
+
+	state_dispatcher(teq::teq &the_teq, boost::python::object callback, int interval_ms = 20) :
+		m_teq(the_teq),
+		m_callback(callback),
+		m_interval(interval_ms),
+		m_stop(std::make_shared<std::atomic<bool>>(false))
+	{
+		m_thread = std::thread(&state_dispatcher::run, this);
+	}
+
+	~state_dispatcher()
+	{
+		stop();
+
+		//! Destroyed from within the callback. See stop()
+		if (true == m_thread.joinable())
+		{
+			m_thread.detach();
+		}
+	}
+
+	/**
+	 * Waits for a running callback to finish. Called from within the
+	 * callback it returns right away and the thread ends when the
+	 * callback returns.
+	 */
+	void stop()
+	{
+		*m_stop = true;
+
+		if (std::this_thread::get_id() == m_thread.get_id())
+		{
+			return;
+		}
+
+		if (true == m_thread.joinable())
+		{
+			gil_release release;
+
+			m_thread.join();
+		}
+	}
+
+	static bool same_state(const teq::teq::state_info &a, const teq::teq::state_info &b)
+	{
+		return 
+			a.m_transport_state == b.m_transport_state &&
+			a.m_transport_position.m_pattern == b.m_transport_position.m_pattern &&
+			a.m_transport_position.m_tick == b.m_transport_position.m_tick &&
+			a.m_loop_range.m_enabled == b.m_loop_range.m_enabled &&
+			a.m_loop_range.m_start.m_pattern == b.m_loop_range.m_start.m_pattern &&
+			a.m_loop_range.m_start.m_tick == b.m_loop_range.m_start.m_tick &&
+			a.m_loop_range.m_end.m_pattern == b.m_loop_range.m_end.m_pattern &&
+			a.m_loop_range.m_end.m_tick == b.m_loop_range.m_end.m_tick;
+	}
+
+	void run()
+	{
+		const std::shared_ptr<std::atomic<bool>> stop = m_stop;
+
+		bool first = true;
+
+		teq::teq::state_info last_state = teq::teq::state_info();
+
+		std::vector<teq::teq::tick_event> tick_events;
+
+		while (false == *stop)
+		{
+			std::this_thread::sleep_for(m_interval);
+
+			const teq::teq::state_info state = m_teq.get_state_info();
+
+			tick_events.clear();
+
+			while (true == m_teq.has_tick_event())
+			{
+				tick_events.push_back(m_teq.get_tick_event());
+			}
+
+			if (false == first && true == tick_events.empty() && true == same_state(state, last_state))
+			{
+				continue;
+			}
+
+			first = false;
+			last_state = state;
+
+			PyGILState_STATE gil_state = PyGILState_Ensure();
+
+			try
+			{
+				boost::python::list the_tick_events;
+
+				for (auto &it : tick_events)
+				{
+					the_tick_events.append(it);
+				}
+
+				m_callback(state, the_tick_events);
+			}
+			catch (const boost::python::error_already_set &)
+			{
+				PyErr_Print();
+			}
+
+			PyGILState_Release(gil_state);
+		}
+	}
+};
+
+/**
+ * The struct module type codes of the fields of EventType, matching
+ * the numpy dtypes in pyteq.py.
+ */
+template<class EventType>
+struct event_format;
+
+template<>
+struct event_format<teq::midi_event>
+{
+	static const char *codes() { return "iIIf"; }
+};
+
+template<>
+struct event_format<teq::cv_event>
+{
+	static const char *codes() { return "iff"; }
+};
+
+template<>
+struct event_format<teq::control_event>
+{
+	static const char *codes() { return "if"; }
+};
+
+/**
+ * Reduces a buffer format like "T{<i:type:<f:value:}" (as numpy 
+ * writes it for structured dtypes) to its type codes, e.g. "if". 
+ * Returns false if the format uses a non-native byte order or
+ * anything else the event structs do not have.
+ */
+static bool format_codes(const char *format, std::string &codes)
+{
+	const uint16_t one = 1;
+	const char native_byte_order = (1 == *(const unsigned char*)&one) ? '<' : '>';
+
+	std::string the_format(0 == format ? "B" : format);
+
+	if (the_format.size() >= 3 && 0 == the_format.compare(0, 2, "T{") && '}' == the_format.back())
+	{
+		the_format = the_format.substr(2, the_format.size() - 3);
+	}
+
+	codes.clear();
+
+	size_t count = 0;
+
+	for (size_t index = 0; index < the_format.size(); ++index)
+	{
+		const char c = the_format[index];
+
+		if (':' == c)
+		{
+			//! A field name
+			index = the_format.find(':', index + 1);
+
+			if (std::string::npos == index)
+			{
+				return false;
+			}
+		}
+		else if ('@' == c || '=' == c || native_byte_order == c)
+		{
+			continue;
+		}
+		else if (c >= '0' && c <= '9')
+		{
+			count = count * 10 + (size_t)(c - '0');
+		}
+		else if ('i' == c || 'I' == c || 'f' == c)
+		{
+			codes.append(std::max((size_t)1, count), c);
+			count = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * A C-contiguous view of a python object supporting the buffer 
+ * protocol (e.g. a numpy array) whose items are EventTypes. A one
+ * dimensional buffer holds ticks of one track, a two dimensional one
+ * holds (tracks, ticks). The item format must match EventType (see
+ * the dtypes in pyteq.py).
+ */
+template<class EventType>
+struct event_buffer
+{
+	Py_buffer m_view;
+
+	int m_number_of_tracks;
+
+	int m_number_of_ticks;
+
+	event_buffer(boost::python::object buffer, bool writable)
+	{
+		if (0 != PyObject_GetBuffer(buffer.ptr(), &m_view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)))
+		{
+			boost::python::throw_error_already_set();
+		}
+
+		if ((size_t)m_view.itemsize != sizeof(EventType) || m_view.ndim < 1 || m_view.ndim > 2)
+		{
+			const Py_ssize_t itemsize = m_view.itemsize;
+			const int ndim = m_view.ndim;
+
+			PyBuffer_Release(&m_view);
+
+			LIBTEQ_THROW_RUNTIME_ERROR("Expected a one or two dimensional buffer of " << sizeof(EventType) << " byte events. Got " << ndim << " dimensions of " << itemsize << " byte items")
+		}
+
+		std::string codes;
+
+		if (false == format_codes(m_view.format, codes) || codes != event_format<EventType>::codes())
+		{
+			const std::string format(0 == m_view.format ? "B" : m_view.format);
+
+			PyBuffer_Release(&m_view);
+
+			LIBTEQ_THROW_RUNTIME_ERROR("Expected items of format " << event_format<EventType>::codes() << " (see the dtypes in pyteq.py). Got " << format)
+		}
+
+		m_number_of_tracks = (2 == m_view.ndim) ? (int)m_view.shape[0] : 1;
+
+		m_number_of_ticks = (int)m_view.shape[m_view.ndim - 1];
+	}
+
+	~event_buffer()
+	{
+		PyBuffer_Release(&m_view);
+	}
+
+	EventType *events(int track_offset)
+	{
+		return (EventType*)m_view.buf + (size_t)track_offset * (size_t)m_number_of_ticks;
+	}
+};
+
+template<class EventType>
+void get_events(const teq::pattern &the_pattern, int first_track, int first_tick, boost::python::object buffer, int column_index)
+{
+	event_buffer<EventType> the_buffer(buffer, true);
+
+	for (int track_offset = 0; track_offset < the_buffer.m_number_of_tracks; ++track_offset)
+	{
+		the_pattern.get_events(first_track + track_offset, first_tick, the_buffer.m_number_of_ticks, the_buffer.events(track_offset), column_index);
+	}
+}
+
+template<class EventType>
+void set_events(teq::pattern &the_pattern, int first_track, int first_tick, boost::python::object buffer, int column_index)
+{
+	event_buffer<EventType> the_buffer(buffer, false);
+
+	for (int track_offset = 0; track_offset < the_buffer.m_number_of_tracks; ++track_offset)
+	{
+		the_pattern.set_events<EventType>(first_track + track_offset, first_tick, the_buffer.m_number_of_ticks, the_buffer.events(track_offset), column_index);
+	}
+}
+
 BOOST_PYTHON_MODULE(teq)
 {
 	using namespace boost::python;
+
+#if PY_VERSION_HEX < 0x03070000
+	// Needed for the GIL handling above
+	PyEval_InitThreads();
+#endif
 	
 	class_<teq::transport_position>("transport_position", init<>())
 		.def(init<teq::tick, teq::tick>())
@@ -26,7 +371,17 @@ BOOST_PYTHON_MODULE(teq)
 		.def_readwrite("transport_state", &teq::teq::state_info::m_transport_state)
 		.def_readwrite("transport_position", &teq::teq::state_info::m_transport_position)
 		.def_readwrite("loop_range", &teq::teq::state_info::m_loop_range)
-		.def_readwrite("is_tick", &teq::teq::state_info::m_is_tick)
+		.def_readwrite("frame_time", &teq::teq::state_info::m_frame_time)
+	;
+
+	class_<teq::teq::tick_event>("tick_event")
+		.def_readwrite("transport_position", &teq::teq::tick_event::m_transport_position)
+		.def_readwrite("frame_time", &teq::teq::tick_event::m_frame_time)
+	;
+
+	enum_<teq::teq::record_mode>("record_mode")
+		.value("OVERDUB", teq::teq::record_mode::OVERDUB)
+		.value("REPLACE", teq::teq::record_mode::REPLACE)
 	;
 
 	class_<teq::loop_range>("loop_range", init<>())
@@ -44,11 +399,39 @@ BOOST_PYTHON_MODULE(teq)
 		.value("CONTROL", teq::track::type::CONTROL)
 	;
 
+	enum_<teq::sequence::storage>("sequence_storage")
+		.value("AUTOMATIC", teq::sequence::storage::AUTOMATIC)
+		.value("DENSE", teq::sequence::storage::DENSE)
+		.value("SPARSE", teq::sequence::storage::SPARSE)
+	;
+
 
-	class_<teq::midi_event>("midi_event", init<optional<teq::midi_event::type, unsigned, unsigned>>())
+	enum_<teq::midi_thru::message_kind>("midi_thru_message_kind")
+		.value("NOTES", teq::midi_thru::NOTES)
+		.value("POLYPHONIC_AFTERTOUCH", teq::midi_thru::POLYPHONIC_AFTERTOUCH)
+		.value("CONTROL_CHANGE", teq::midi_thru::CONTROL_CHANGE)
+		.value("PROGRAM_CHANGE", teq::midi_thru::PROGRAM_CHANGE)
+		.value("CHANNEL_PRESSURE", teq::midi_thru::CHANNEL_PRESSURE)
+		.value("PITCH_BEND", teq::midi_thru::PITCH_BEND)
+		.value("ALL", teq::midi_thru::ALL)
+	;
+
+	class_<teq::midi_thru>("midi_thru")
+		.def_readwrite("enabled", &teq::midi_thru::m_enabled)
+		.def_readwrite("input_channel", &teq::midi_thru::m_input_channel)
+		.def_readwrite("output_channel", &teq::midi_thru::m_output_channel)
+		.def_readwrite("message_kinds", &teq::midi_thru::m_message_kinds)
+		.def_readwrite("lowest_note", &teq::midi_thru::m_lowest_note)
+		.def_readwrite("highest_note", &teq::midi_thru::m_highest_note)
+		.def_readwrite("transpose", &teq::midi_thru::m_transpose)
+		.def_readwrite("velocity_scale", &teq::midi_thru::m_velocity_scale)
+	;
+
+	class_<teq::midi_event>("midi_event", init<optional<teq::midi_event::type, unsigned, unsigned, float>>())
 		.def_readwrite("type", &teq::midi_event::m_type)
 		.def_readwrite("value1", &teq::midi_event::m_value1)
 		.def_readwrite("value2", &teq::midi_event::m_value2)
+		.def_readwrite("length", &teq::midi_event::m_length)
 	;
 
 	enum_<teq::midi_event::type>("midi_event_type")
@@ -57,6 +440,9 @@ BOOST_PYTHON_MODULE(teq)
 		.value("OFF", teq::midi_event::type::OFF)
 		.value("CC", teq::midi_event::type::CC)
 		.value("PITCHBEND", teq::midi_event::PITCHBEND)
+		.value("AFTERTOUCH", teq::midi_event::AFTERTOUCH)
+		.value("CHANNEL_PRESSURE", teq::midi_event::CHANNEL_PRESSURE)
+		.value("PROGRAM_CHANGE", teq::midi_event::PROGRAM_CHANGE)
 	;
 
 
@@ -84,13 +470,28 @@ BOOST_PYTHON_MODULE(teq)
 		.value("RELATIVE_TEMPO", teq::control_event::type::RELATIVE_TEMPO)
 	;
 
+	/**
+	 * pattern_ptrs converted from python objects drop their reference
+	 * without taking the GIL, so they must never end up in a song (songs
+	 * are freed by gc() on other threads). Transactions copy the 
+	 * patterns passed to insert/set_pattern.
+	 */
 	class_<teq::pattern, teq::pattern_ptr>("pattern")
 		.def("set_midi_event", &teq::pattern::set_event<teq::midi_event>)
 		.def("get_midi_event", &teq::pattern::get_event<teq::midi_event>)
+		.def("set_midi_column_event", &teq::pattern::set_column_event<teq::midi_event>)
+		.def("get_midi_column_event", &teq::pattern::get_column_event<teq::midi_event>)
+		.def("number_of_columns", &teq::pattern::number_of_columns)
 		.def("set_control_event", &teq::pattern::set_event<teq::control_event>)
 		.def("get_control_event", &teq::pattern::get_event<teq::control_event>)
 		.def("set_cv_event", &teq::pattern::set_event<teq::cv_event>)
 		.def("get_cv_event", &teq::pattern::get_event<teq::cv_event>)
+		.def("get_midi_events", &get_events<teq::midi_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
+		.def("set_midi_events", &set_events<teq::midi_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
+		.def("get_cv_events", &get_events<teq::cv_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
+		.def("set_cv_events", &set_events<teq::cv_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
+		.def("get_control_events", &get_events<teq::control_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
+		.def("set_control_events", &set_events<teq::control_event>, (arg("self"), arg("first_track"), arg("first_tick"), arg("buffer"), arg("column") = 0))
 		.def("length", &teq::pattern::length)
 		.def("mute_sequence", &teq::pattern::mute_sequence)
 		.def_readwrite("name", &teq::pattern::m_name)
@@ -99,35 +500,85 @@ BOOST_PYTHON_MODULE(teq)
 	;
 	
 	
-	class_<teq::teq>("teq", init<optional<std::string, unsigned>>())
+	class_<teq::teq::transaction, boost::noncopyable>("transaction", init<teq::teq&>()[with_custodian_and_ward<1, 2>()])
+		.def("number_of_tracks", &teq::teq::transaction::number_of_tracks)
+		.def("number_of_patterns", &teq::teq::transaction::number_of_patterns)
+		.def("create_pattern", &teq::teq::transaction::create_pattern)
+		.def("insert_midi_track", LIBTEQ_WITHOUT_GIL(&teq::teq::transaction::insert_midi_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("insert_cv_track", LIBTEQ_WITHOUT_GIL(&teq::teq::transaction::insert_cv_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("insert_control_track", LIBTEQ_WITHOUT_GIL(&teq::teq::transaction::insert_control_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("insert_pattern", &teq::teq::transaction::insert_pattern)
+		.def("set_pattern", &teq::teq::transaction::set_pattern)
+		.def("set_midi_event", &teq::teq::transaction::set_event<teq::midi_event>)
+		.def("set_midi_column_event", &teq::teq::transaction::set_column_event<teq::midi_event>)
+		.def("set_cv_event", &teq::teq::transaction::set_event<teq::cv_event>)
+		.def("set_control_event", &teq::teq::transaction::set_event<teq::control_event>)
+		.def("set_loop_range", &teq::teq::transaction::set_loop_range)
+		.def("set_global_tempo", &teq::teq::transaction::set_global_tempo)
+		.def("set_ticks_per_beat", &teq::teq::transaction::set_ticks_per_beat)
+		.def("set_transport_state", &teq::teq::transaction::set_transport_state)
+		.def("set_transport_source", &teq::teq::transaction::set_transport_source)
+		.def("set_transport_position", &teq::teq::transaction::set_transport_position)
+		.def("set_send_all_notes_off_on_loop", &teq::teq::transaction::set_send_all_notes_off_on_loop)
+		.def("set_send_all_notes_off_on_stop", &teq::teq::transaction::set_send_all_notes_off_on_stop)
+		.def("set_midi_thru", &teq::teq::transaction::set_midi_thru)
+		.def("set_number_of_columns", &teq::teq::transaction::set_number_of_columns)
+		.def("commit", LIBTEQ_WITHOUT_GIL(&teq::teq::transaction::commit))
+	;
+	
+	class_<teq::teq>("teq", init<optional<std::string, int, int, bool>>())
 		.def("gc", &teq::teq::gc)
-		.def("set_global_tempo", &teq::teq::set_global_tempo)
-		.def("set_ticks_per_beat", &teq::teq::set_ticks_per_beat)
+		.def("set_global_tempo", LIBTEQ_WITHOUT_GIL(&teq::teq::set_global_tempo))
+		.def("set_ticks_per_beat", LIBTEQ_WITHOUT_GIL(&teq::teq::set_ticks_per_beat))
 		.def("get_ticks_per_beat", &teq::teq::set_ticks_per_beat)
 		.def("get_global_tempo", &teq::teq::get_global_tempo)
-		.def("set_loop_range", &teq::teq::set_loop_range)
+		.def("set_loop_range", LIBTEQ_WITHOUT_GIL(&teq::teq::set_loop_range))
 		.def("get_loop_range", &teq::teq::get_loop_range)
-		.def("set_transport_state", &teq::teq::set_transport_state)
+		.def("set_transport_state", LIBTEQ_WITHOUT_GIL(&teq::teq::set_transport_state))
 		.def("get_transport_source", &teq::teq::get_transport_source)
-		.def("set_transport_source", &teq::teq::set_transport_source)
-		.def("set_transport_position", &teq::teq::set_transport_position)
-		.def("set_send_all_notes_off_on_loop", &teq::teq::set_send_all_notes_off_on_loop)
-		.def("set_send_all_notes_off_on_stop", &teq::teq::set_send_all_notes_off_on_stop)
+		.def("set_transport_source", LIBTEQ_WITHOUT_GIL(&teq::teq::set_transport_source))
+		.def("set_transport_position", LIBTEQ_WITHOUT_GIL(&teq::teq::set_transport_position))
+		.def("position_to_frame", &teq::teq::position_to_frame)
+		.def("frame_to_position", &teq::teq::frame_to_position)
+		.def("set_send_all_notes_off_on_loop", LIBTEQ_WITHOUT_GIL(&teq::teq::set_send_all_notes_off_on_loop))
+		.def("set_send_all_notes_off_on_stop", LIBTEQ_WITHOUT_GIL(&teq::teq::set_send_all_notes_off_on_stop))
 		.def("number_of_tracks", &teq::teq::number_of_tracks)
 		.def("track_name", &teq::teq::track_name)
 		.def("track_type", &teq::teq::track_type)
-		.def("insert_midi_track", &teq::teq::insert_midi_track)
-		.def("insert_cv_track", &teq::teq::insert_cv_track)
-		.def("insert_control_track", &teq::teq::insert_control_track)
-		.def("rename_track", &teq::teq::rename_track)
-		.def("insert_pattern", &teq::teq::insert_pattern)
-		.def("set_pattern", &teq::teq::set_pattern)
+		.def("insert_midi_track", LIBTEQ_WITHOUT_GIL(&teq::teq::insert_midi_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("insert_cv_track", LIBTEQ_WITHOUT_GIL(&teq::teq::insert_cv_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("insert_control_track", LIBTEQ_WITHOUT_GIL(&teq::teq::insert_control_track), (arg("self"), arg("track_name"), arg("index"), arg("sequence_storage") = teq::sequence::AUTOMATIC))
+		.def("rename_track", LIBTEQ_WITHOUT_GIL(&teq::teq::rename_track))
+		.def("insert_pattern", LIBTEQ_WITHOUT_GIL(&teq::teq::insert_pattern))
+		.def("set_pattern", LIBTEQ_WITHOUT_GIL(&teq::teq::set_pattern))
+		.def("set_midi_event", LIBTEQ_WITHOUT_GIL(&teq::teq::set_event<teq::midi_event>))
+		.def("set_midi_column_event", LIBTEQ_WITHOUT_GIL(&teq::teq::set_column_event<teq::midi_event>))
+		.def("set_cv_event", LIBTEQ_WITHOUT_GIL(&teq::teq::set_event<teq::cv_event>))
+		.def("set_control_event", LIBTEQ_WITHOUT_GIL(&teq::teq::set_event<teq::control_event>))
+		.def("set_midi_thru", LIBTEQ_WITHOUT_GIL(&teq::teq::set_midi_thru))
+		.def("get_midi_thru", &teq::teq::get_midi_thru)
+		.def("set_number_of_columns", LIBTEQ_WITHOUT_GIL(&teq::teq::set_number_of_columns))
+		.def("get_number_of_columns", &teq::teq::get_number_of_columns)
 		.def("number_of_patterns", &teq::teq::number_of_patterns)
 		.def("create_pattern", &teq::teq::create_pattern)
 		.def("get_pattern", &teq::teq::get_pattern)
+		.def("get_pattern_deep_copy", &teq::teq::get_pattern_deep_copy)
 		.def("has_state_info", &teq::teq::has_state_info)
 		.def("get_state_info", &teq::teq::get_state_info)
-		.def("wait", &teq::teq::wait)
-		.def("deactivate", &teq::teq::deactivate)
+		.def("set_tick_events_enabled", &teq::teq::set_tick_events_enabled)
+		.def("has_tick_event", &teq::teq::has_tick_event)
+		.def("get_tick_event", &teq::teq::get_tick_event)
+		.def("dropped_tick_events", &teq::teq::dropped_tick_events)
+		.def("start_recording", LIBTEQ_WITHOUT_GIL(&teq::teq::start_recording), (arg("self"), arg("track_index"), arg("mode") = teq::teq::OVERDUB))
+		.def("stop_recording", LIBTEQ_WITHOUT_GIL(&teq::teq::stop_recording))
+		.def("is_recording", &teq::teq::is_recording)
+		.def("dropped_recorded_events", &teq::teq::dropped_recorded_events)
+		.def("wait", LIBTEQ_WITHOUT_GIL(&teq::teq::wait))
+		.def("deactivate", LIBTEQ_WITHOUT_GIL(&teq::teq::deactivate))
+		.def("render", LIBTEQ_WITHOUT_GIL(&teq::teq::render))
+	;
+
+	class_<state_dispatcher, boost::noncopyable>("state_dispatcher", init<teq::teq&, object, optional<int>>()[with_custodian_and_ward<1, 2>()])
+		.def("stop", &state_dispatcher::stop)
 	;
 }
\ No newline at end of file
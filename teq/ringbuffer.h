@@ -45,6 +45,11 @@ namespace lart
 		}
 
 		bool can_write() {
+			// The jack ringbuffer rounds its size up, so it might hold more indices than there are elements
+			if (jack_ringbuffer_read_space(jack_ringbuffer) / sizeof(size_t) >= size) {
+				return false;
+			}
+
 			if (jack_ringbuffer_write_space(jack_ringbuffer) >= sizeof(size_t)) {
 				return true;
 			}
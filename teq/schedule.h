@@ -0,0 +1,58 @@
+#ifndef LIBTEQ_SCHEDULE_HH
+#define LIBTEQ_SCHEDULE_HH
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <teq/event.h>
+
+namespace teq
+{
+	/**
+	 * The non-empty events of one event type of a pattern in tick
+	 * order. The events of tick t are
+	 * m_entries[m_tick_offsets[t]] to m_entries[m_tick_offsets[t + 1] - 1].
+	 */
+	template<class EventType>
+	struct event_schedule
+	{
+		struct entry
+		{
+			/**
+			 * The index of the track among the tracks of its type. This
+			 * is the index into the arrays of the track_view.
+			 */
+			uint32_t m_type_index;
+
+			//! The column of the track the event is in (see midi_track::m_number_of_columns)
+			uint32_t m_column;
+
+			EventType m_event;
+		};
+
+		std::vector<entry> m_entries;
+
+		std::vector<uint32_t> m_tick_offsets;
+	};
+
+	/**
+	 * The compiled form of a pattern the RT thread plays from. It is
+	 * built on the edit path whenever a song version is committed
+	 * (see teq::update_song()). Building it resolves all the track
+	 * targets and drops all NONE events, so the RT thread only ever
+	 * touches events that actually do something.
+	 */
+	struct pattern_schedule
+	{
+		event_schedule<midi_event> m_midi_events;
+
+		event_schedule<cv_event> m_cv_events;
+
+		event_schedule<control_event> m_control_events;
+	};
+
+	typedef std::shared_ptr<const pattern_schedule> pattern_schedule_ptr;
+} // namespace
+
+#endif
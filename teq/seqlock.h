@@ -0,0 +1,98 @@
+#ifndef LIBTEQ_SEQLOCK_HH
+#define LIBTEQ_SEQLOCK_HH
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace teq
+{
+	/**
+	 * Holds the latest value of a trivially copyable T written by a
+	 * single writer (the RT thread) for any number of readers. The
+	 * writer never waits. Readers retry while a write is in progress,
+	 * which only takes as long as copying a T.
+	 *
+	 * The value is stored in atomic words, so the torn reads a reader
+	 * detects and retries are not data races.
+	 */
+	template<class T>
+	struct seqlock
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "seqlock values must be trivially copyable");
+
+		static const size_t number_of_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+		//! Odd while a write is in progress
+		std::atomic<uint64_t> m_sequence;
+
+		std::atomic<uint64_t> m_words[number_of_words];
+
+		seqlock(const T &initial_value = T()) :
+			m_sequence(0)
+		{
+			for (auto &word : m_words)
+			{
+				word.store(0, std::memory_order_relaxed);
+			}
+
+			write(initial_value);
+		}
+
+		//! RT-safe. Only ever call from one thread at a time
+		void write(const T &value)
+		{
+			uint64_t words[number_of_words] = { };
+			memcpy(words, &value, sizeof(T));
+
+			const uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+
+			m_sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			for (size_t index = 0; index < number_of_words; ++index)
+			{
+				m_words[index].store(words[index], std::memory_order_relaxed);
+			}
+
+			m_sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		T read() const
+		{
+			uint64_t words[number_of_words];
+
+			uint64_t sequence_before;
+			uint64_t sequence_after;
+
+			do
+			{
+				sequence_before = m_sequence.load(std::memory_order_acquire);
+
+				for (size_t index = 0; index < number_of_words; ++index)
+				{
+					words[index] = m_words[index].load(std::memory_order_relaxed);
+				}
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				sequence_after = m_sequence.load(std::memory_order_relaxed);
+			}
+			while ((sequence_before & 1) || sequence_before != sequence_after);
+
+			T value;
+			memcpy(&value, words, sizeof(T));
+
+			return value;
+		}
+
+		//! Changes with every write()
+		uint64_t sequence() const
+		{
+			return m_sequence.load(std::memory_order_acquire);
+		}
+	};
+} // namespace
+
+#endif
@@ -6,10 +6,15 @@
 #include <memory>
 #include <map>
 #include <utility>
+#include <algorithm>
 
 #include <teq/pattern.h>
 #include <teq/track.h>
 #include <teq/transport.h>
+#include <teq/backend.h>
+#include <teq/schedule.h>
+#include <teq/tempo_map.h>
+#include <teq/track_view.h>
 
 #include <teq/exception.h>
 
@@ -28,25 +33,21 @@ namespace teq
 	 * 3] Use the update_song() method to replace the current song
 	 * with the edited copy in a RT-safe way.
 	 *
-	 * NOTE: Since pattern data (the data itself - notes, cv_events, etc),
-	 * not the structure,  is plain old data (POD) it can be 
-	 * edited by passing the function to update the event as a lambda 
-	 * into the process loop via the write_command_and_wait() method.
-	 *
-	 * NOTE: When an editing operation modifies more than a singe event,
-	 * it is probably more efficient (timewise, since write_command_and_wait()
+	 * NOTE: When an editing operation modifies more than a single thing
+	 * it is more efficient (timewise, since write_command_and_wait()
 	 * waits after each command until the command has been executed) to 
-	 * make a copy of the song, then a copy of the pattern in question,
-	 * edit it ad then commit the resulting updated pattern in a single i
-	 * operation.
+	 * collect all changes in a teq::transaction and commit them in a
+	 * single operation.
 	*/
 	struct song
 	{
 		/**
-		 * To determine hat pattern has a global tick position just lookup
-		 * (*m_Transport_lookup_list)[position].
+		 * The prefix sums of the pattern lengths: (*m_transport_lookup_list)[index]
+		 * is the global tick at which pattern index starts, the last 
+		 * entry is the length of the song. See find_pattern() and
+		 * teq::update_transport_lookup_list().
 		 */
-		typedef std::vector<transport_position> transport_lookup_list;
+		typedef std::vector<tick> transport_lookup_list;
 		typedef std::shared_ptr<transport_lookup_list> transport_lookup_list_ptr;
 
 		transport_lookup_list_ptr m_transport_lookup_list;
@@ -59,32 +60,90 @@ namespace teq
 
 		pattern_list_ptr m_pattern_list;
 
+		/**
+		 * The compiled patterns the RT thread plays from. 
+		 * (*m_schedule_list)[index] belongs to (*m_pattern_list)[index].
+		 * See teq::update_song().
+		 */
+		typedef std::vector<pattern_schedule_ptr> schedule_list;
+		typedef std::shared_ptr<schedule_list> schedule_list_ptr;
+
+		schedule_list_ptr m_schedule_list;
+
+		/**
+		 * Built from the control events of the song. See 
+		 * teq::update_tempo_map().
+		 */
+		tempo_map_ptr m_tempo_map;
+
 
 		/**
-		 * This violates separation of concern, but since we don't plan
-		 * to support backends other than jack, it's ok.
-		 * 
 		 * A track is tied to a port, so here's where we store the port
-		 * handle.
+		 * handle. The port is owned by the backend. Control tracks
+		 * have no port.
 		 */
-		typedef std::pair<track_ptr, jack_port_t *> track_properties_and_payload;
+		typedef std::pair<track_ptr, backend::port *> track_properties_and_payload;
 		
 		typedef std::vector<track_properties_and_payload> track_list;
 		typedef std::shared_ptr<track_list> track_list_ptr;
 		
 		track_list_ptr m_track_list;
 		
+		/**
+		 * The RT thread's view of the tracks. See teq::update_song().
+		 */
+		track_view_ptr m_track_view;
+		
 
 		std::string m_name;
 	
 		std::string m_description;
 		
 		song(pattern_list_ptr the_pattern_list, track_list_ptr the_track_list) :
-			m_transport_lookup_list(new transport_lookup_list),
+			m_transport_lookup_list(new transport_lookup_list(1, 0)),
 			m_pattern_list(the_pattern_list),
-			m_track_list(the_track_list)
+			m_schedule_list(new schedule_list),
+			m_tempo_map(new tempo_map),
+			m_track_list(the_track_list),
+			m_track_view(new track_view)
+		{
+			
+		}
+
+		/**
+		 * The index of the pattern that plays at the global tick 
+		 * position song_tick, i.e. the last pattern starting at or
+		 * before it. Ticks past the end of the song map to the last
+		 * pattern. Needs at least one pattern.
+		 *
+		 * RT-safe. O(log(number of patterns)).
+		 */
+		size_t find_pattern(double song_tick) const
+		{
+			const transport_lookup_list &starts = *m_transport_lookup_list;
+
+			const auto next = std::upper_bound
+			(
+				starts.begin(), 
+				starts.end() - 1, 
+				song_tick, 
+				[](double the_tick, tick start) { return the_tick < (double)start; }
+			);
+
+			return (next == starts.begin()) ? 0 : (size_t)(next - starts.begin() - 1);
+		}
+
+		bool track_name_exists(const std::string &track_name) const
 		{
+			for (auto &it : *m_track_list)
+			{
+				if (track_name == it.first->m_name)
+				{
+					return true;
+				}
+			}
 			
+			return false;
 		}
 
 		void check_track_index(int index)
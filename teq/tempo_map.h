@@ -0,0 +1,157 @@
+#ifndef LIBTEQ_TEMPO_MAP_HH
+#define LIBTEQ_TEMPO_MAP_HH
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <teq/transport.h>
+
+namespace teq
+{
+	/**
+	 * The tempo of a song along its global tick positions as set by
+	 * the GLOBAL_TEMPO and RELATIVE_TEMPO control events, assuming the
+	 * song is played from the start without looping. It is built on
+	 * the edit path whenever a song version is committed (see
+	 * teq::update_tempo_map()).
+	 *
+	 * Until the first GLOBAL_TEMPO event the global tempo is not known
+	 * in advance (it is set with teq::set_global_tempo() or by JACK),
+	 * so all conversions take that base tempo as an argument. Times
+	 * are in seconds since the start of the song.
+	 *
+	 * All lookups are RT-safe and O(log(number of tempo changes)).
+	 */
+	struct tempo_map
+	{
+		/**
+		 * The tempo in effect from m_tick up to the next segment. The
+		 * events of a tick are applied before the tick is played, so
+		 * the tempo changes right at m_tick.
+		 */
+		struct segment
+		{
+			tick m_tick;
+
+			//! If false the base tempo is the global tempo
+			bool m_has_global_tempo;
+
+			float m_global_tempo;
+
+			float m_relative_tempo;
+
+			//! The time spent before m_tick at a known global tempo
+			double m_seconds;
+
+			/**
+			 * The ticks played before m_tick at the base tempo, divided
+			 * by their relative tempo. The time spent on them is this
+			 * divided by the base tempo.
+			 */
+			double m_base_ticks;
+
+			double ticks_per_second(double base_tempo) const
+			{
+				return (double)m_relative_tempo * (m_has_global_tempo ? (double)m_global_tempo : base_tempo);
+			}
+
+			double start_seconds(double base_tempo) const
+			{
+				return m_seconds + m_base_ticks / base_tempo;
+			}
+		};
+
+		//! Sorted by m_tick. The first segment always starts at tick 0
+		std::vector<segment> m_segments;
+
+		tempo_map()
+		{
+			m_segments.push_back(segment{0, false, 0, 1, 0, 0});
+		}
+
+		/**
+		 * Call with increasing ticks to build the map. Changes that do
+		 * not change the tempo are dropped.
+		 */
+		void change_tempo(tick the_tick, bool has_global_tempo, float global_tempo, float relative_tempo)
+		{
+			const segment &last = m_segments.back();
+
+			if (has_global_tempo == last.m_has_global_tempo && (false == has_global_tempo || global_tempo == last.m_global_tempo) && relative_tempo == last.m_relative_tempo)
+			{
+				return;
+			}
+
+			segment next = last;
+
+			const double ticks = (double)(the_tick - last.m_tick);
+
+			if (true == last.m_has_global_tempo)
+			{
+				next.m_seconds += ticks / ((double)last.m_relative_tempo * (double)last.m_global_tempo);
+			}
+			else
+			{
+				next.m_base_ticks += ticks / (double)last.m_relative_tempo;
+			}
+
+			next.m_tick = the_tick;
+			next.m_has_global_tempo = has_global_tempo;
+			next.m_global_tempo = global_tempo;
+			next.m_relative_tempo = relative_tempo;
+
+			if (the_tick == last.m_tick)
+			{
+				m_segments.back() = next;
+			}
+			else
+			{
+				m_segments.push_back(next);
+			}
+		}
+
+		/**
+		 * The segment whose tempo takes the song from the tick before
+		 * song_tick to song_tick, i.e. the last one starting before it.
+		 */
+		const segment &segment_before(double song_tick) const
+		{
+			const auto next = std::lower_bound
+			(
+				m_segments.begin() + 1,
+				m_segments.end(),
+				song_tick,
+				[](const segment &the_segment, double the_tick) { return (double)the_segment.m_tick < the_tick; }
+			);
+
+			return *(next - 1);
+		}
+
+		double tick_to_seconds(double song_tick, double base_tempo) const
+		{
+			const segment &the_segment = segment_before(song_tick);
+
+			return the_segment.start_seconds(base_tempo) + (song_tick - (double)the_segment.m_tick) / the_segment.ticks_per_second(base_tempo);
+		}
+
+		double seconds_to_tick(double seconds, double base_tempo) const
+		{
+			const auto next = std::upper_bound
+			(
+				m_segments.begin() + 1,
+				m_segments.end(),
+				seconds,
+				[base_tempo](double the_seconds, const segment &the_segment) { return the_seconds < the_segment.start_seconds(base_tempo); }
+			);
+
+			const segment &the_segment = *(next - 1);
+
+			return (double)the_segment.m_tick + (seconds - the_segment.start_seconds(base_tempo)) * the_segment.ticks_per_second(base_tempo);
+		}
+	};
+
+	typedef std::shared_ptr<const tempo_map> tempo_map_ptr;
+} // namespace
+
+#endif
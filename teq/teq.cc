@@ -1,4 +1,5 @@
 #include <teq/teq.h>
+#include <teq/jack_backend.h>
 #include <cassert>
 
 #include <chrono>
@@ -8,15 +9,26 @@ namespace teq
 {
 	extern "C" 
 	{
-		int jack_process(jack_nframes_t nframes, void *arg)
+		int process_callback(nframes_t nframes, void *arg)
 		{
 			return ((teq*)arg)->process(nframes);
 		}
 	}
 
+	backend_ptr teq::create_backend(const std::string client_name, bool offline)
+	{
+		if (true == offline)
+		{
+			return backend_ptr(new null_backend);
+		}
+		
+		return backend_ptr(new jack_backend(client_name));
+	}
+	
 	void teq::init
 	(
 		const std::string client_name,
+		backend_ptr the_backend,
 		transport_state the_transport_state,
 		transport_position the_transport_position,
 		bool send_all_notes_off_on_loop,
@@ -25,8 +37,52 @@ namespace teq
 	{
 		m_client_name = client_name;
 		
+		m_backend = the_backend;
+		
 		m_ack = false;
 		
+		m_written_commands = 0;
+		
+		m_executed_commands = 0;
+		
+		m_stop_completion_thread = false;
+		
+		m_stop_reclamation_thread = false;
+		
+		m_tick_events_enabled = false;
+		
+		m_dropped_tick_events = 0;
+		
+		m_read_state_info_sequence = 0;
+		
+		m_recording = false;
+		
+		m_recording_replaces = false;
+		
+		m_dropped_recorded_events = 0;
+		
+		m_midi_in_buffer = 0;
+		
+		m_last_tick_frame = 0;
+		
+		m_has_played_tick = false;
+		
+		m_stop_recording_thread = false;
+		
+		m_recorded_track = -1;
+		
+		m_record_mode = OVERDUB;
+		
+		m_recorded_ticks_played = 0;
+		
+		m_recorded_note = -1;
+		
+		m_period_start_frame = 0;
+		
+		m_note_offs_pending = false;
+		
+		m_stop_frame = -1;
+		
 		m_ticks_per_beat = 4;
 		
 		m_transport_source = transport_source::INTERNAL;
@@ -35,108 +91,113 @@ namespace teq
 		
 		m_transport_state = the_transport_state;
 		
-		m_last_jack_transport_state = JackTransportStopped;
-		m_last_jack_position.frame = 0;
+		m_last_backend_transport = backend::transport_info();
 		
 		m_global_tempo = 8.0;
 		
+		m_base_global_tempo = 8.0;
+		
 		m_relative_tempo = 1.0;
 		
 		m_send_all_notes_off_on_loop = send_all_notes_off_on_loop;
 		
 		m_send_all_notes_off_on_stop = send_all_notes_off_on_stop;
 		
-		m_song = m_song_heap.add_new(song(song::pattern_list_ptr(new song::pattern_list()), song::track_list_ptr(new song::track_list())));
-		
-		jack_status_t status;
-		m_jack_client = jack_client_open(m_client_name.c_str(), JackNullOption, &status);
-		
-		if (0 == m_jack_client)
-		{
-			throw std::runtime_error("Failed to open jack client");
-		}
+		std::atomic_store(&m_song, m_song_heap.publish(song_ptr(new song(song::pattern_list_ptr(new song::pattern_list()), song::track_list_ptr(new song::track_list())))));
+
+		m_rt_song = m_song.get();
 		
-		m_multi_out_port = jack_port_register(m_jack_client, "multi", JACK_DEFAULT_MIDI_TYPE, JackPortIsTerminal | JackPortIsOutput, 0);
+		m_song_heap.set_in_use(m_rt_song);
 		
-		if (0 == m_multi_out_port)
-		{
-			throw std::runtime_error("Failed to register multi output port");
-		}
+		m_last_transport_state = transport_state::STOPPED;
 		
-		m_midi_in_port = jack_port_register(m_jack_client, "in", JACK_DEFAULT_MIDI_TYPE, JackPortIsTerminal | JackPortIsInput, 0);
+		m_tick_clock = tick_clock();
 		
-		if (0 == m_midi_in_port)
-		{
-			throw std::runtime_error("Failed to register in  port");
-		}
+		m_multi_out_port = m_backend->register_port("multi", backend::port_type::MIDI_OUTPUT);
 		
-		int set_process_return_code = jack_set_process_callback(m_jack_client, jack_process, this);
+		m_midi_in_port = m_backend->register_port("in", backend::port_type::MIDI_INPUT);
 		
-		if (0 != set_process_return_code)
-		{
-			jack_client_close(m_jack_client);
-			throw std::runtime_error("Failed to set jack process callback");
-		}
+		m_backend->set_process_callback(process_callback, this);
 		
-		m_last_transport_state = transport_state::STOPPED;
+		m_backend->activate();
 		
-		m_time_until_next_tick = 0;
+		m_completion_thread = std::thread(&teq::run_completions, this);
 		
-		int activate_return_code = jack_activate(m_jack_client);
+		m_reclamation_thread = std::thread(&teq::run_reclamation, this);
 		
-		if (0 != activate_return_code)
-		{
-			jack_client_close(m_jack_client);
-			throw std::runtime_error("Failed to activate jack client");
-		}
+		m_recording_thread = std::thread(&teq::run_recording, this);
 	}
 	
 	void teq::deactivate()
 	{
-		jack_deactivate(m_jack_client);
+		m_backend->deactivate();
 	}
 	
 	teq::~teq()
 	{
-		// jack_deactivate(m_jack_client);
-		jack_client_close(m_jack_client);
+		/**
+		 * The backend might outlive us if someone else holds a 
+		 * reference, so make sure it does not call back into
+		 * a dead object.
+		 */
+		m_backend->deactivate();
+		
+		try
+		{
+			m_backend->set_process_callback(0, 0);
+		}
+		catch (const std::exception &)
+		{
+			//! Nothing to be done about it here, and the backend is deactivated anyway
+		}
+		
+		{
+			std::lock_guard<std::mutex> lock(m_recording_mutex);
+			m_stop_recording_thread = true;
+		}
+		
+		m_recording_condition_variable.notify_all();
+		m_recording_thread.join();
+		
+		{
+			std::lock_guard<std::mutex> lock(m_completion_mutex);
+			m_stop_completion_thread = true;
+		}
+		
+		m_completion_condition_variable.notify_all();
+		m_completion_thread.join();
+		
+		{
+			std::lock_guard<std::mutex> lock(m_reclamation_mutex);
+			m_stop_reclamation_thread = true;
+		}
+		
+		m_reclamation_condition_variable.notify_all();
+		m_reclamation_thread.join();
 	}
 	
 	void teq::set_send_all_notes_off_on_loop(bool on)
 	{
-		write_command_and_wait
-		(
-			[this, on]()
-			{
-				m_send_all_notes_off_on_loop = on;
-			}
-		);
+		write_command_and_wait(command::set_send_all_notes_off_on_loop(on));
 	}
 	
 	void teq::set_send_all_notes_off_on_stop(bool on)
 	{
-		write_command_and_wait
-		(
-			[this, on]()
-			{
-				m_send_all_notes_off_on_stop = on;
-			}
-		);
+		write_command_and_wait(command::set_send_all_notes_off_on_stop(on));
 	}
 
 	bool teq::track_name_exists(const std::string track_name)
 	{
-		return std::any_of(m_song->m_track_list->begin(), m_song->m_track_list->end(),
-				   [&track_name]
-				   (song::track_properties_and_payload const &pair) {
-					return track_name == pair.first->m_name; });
+		return load_song()->track_name_exists(track_name);
 	}
 
 	song_ptr teq::copy_song_shallow()
 	{
-		song_ptr new_song = m_song_heap.add_new(song(*m_song));
+		const song_ptr the_song = load_song();
+
+		song_ptr new_song(new song(*the_song));
 
-		assert(new_song != m_song);
+		assert(new_song != the_song);
 				
 		return new_song;
 	}
@@ -144,22 +205,17 @@ namespace teq
 
 	song_ptr teq::copy_song_top_level_deep()
 	{
-		song_ptr new_song = copy_song_shallow();
+		const song_ptr the_song = load_song();
 
-		new_song->m_transport_lookup_list = song::transport_lookup_list_ptr
-			(new song::transport_lookup_list(*(m_song->m_transport_lookup_list)));
+		song_ptr new_song(new song(*the_song));
 
 		new_song->m_pattern_list = song::pattern_list_ptr
-			(new song::pattern_list(*(m_song->m_pattern_list)));
+			(new song::pattern_list(*(the_song->m_pattern_list)));
 
 		new_song->m_track_list = song::track_list_ptr
-			(new song::track_list(*(m_song->m_track_list)));
+			(new song::track_list(*(the_song->m_track_list)));
 
-		assert(new_song->m_transport_lookup_list != m_song->m_transport_lookup_list);
-
-		assert(new_song->m_track_list != m_song->m_track_list);
-
-		assert(new_song->m_transport_lookup_list != m_song->m_transport_lookup_list);
+		assert(new_song->m_track_list != the_song->m_track_list);
 
 		return new_song;
 	}
@@ -171,34 +227,25 @@ namespace teq
 		return new_song;
 	}
 	
-	void teq::check_track_name_and_index_for_insert(const std::string track_name, int index)
-	{
-		if (true == track_name_exists(track_name))
-		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Track name already exists: " << track_name)
-		}
-		
-		if (index < 0 || index > number_of_tracks())
-		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Track index out of bounds: " << index << ". Number of tracks: " << number_of_tracks())
-		}
-	}
-	
 	track::type teq::track_type(int index)
 	{
-		m_song->check_track_index(index);
+		const song_ptr the_song = load_song();
+
+		the_song->check_track_index(index);
 		
-		return (*m_song->m_track_list)[index].first->m_type;
+		return (*the_song->m_track_list)[index].first->m_type;
 	}
 	
 	//! For internal use only!
-	template <class SequenceType, class TrackType>
-	void insert_track(const std::string &name, song_ptr new_song, int index, jack_port_t *port)
+	template <class TrackType>
+	void insert_track(const std::string &name, sequence::storage sequence_storage, song_ptr new_song, int index, backend::port *port)
 	{
+		const track_ptr new_track(new TrackType(name, sequence_storage));
+		
 		new_song->m_track_list->insert
 		(
 			new_song->m_track_list->begin() + index, 
-			std::make_pair(track_ptr(new TrackType(name)), port)
+			std::make_pair(new_track, port)
 		);
 		
 		for (auto &it : *new_song->m_pattern_list)
@@ -206,53 +253,38 @@ namespace teq
 			it->m_sequences.insert
 			(
 				it->m_sequences.begin() + index,
-				sequence_ptr(new SequenceType)
+				new_track->create_sequence()
 			);
 			
 			(*(it->m_sequences.begin() + index))->set_length(it->m_length);
 		}
 	}
 	
-	void teq::insert_midi_track(const std::string track_name, int index)
+	void teq::insert_midi_track(const std::string track_name, int index, sequence::storage sequence_storage)
 	{
-		check_track_name_and_index_for_insert(track_name, index);
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
 		
-		song_ptr new_song = copy_song_top_level_deep();
-		
-		jack_port_t *port = jack_port_register
-		(
-			m_jack_client, 
-			track_name.c_str(), 
-			JACK_DEFAULT_MIDI_TYPE, 
-			JackPortIsOutput | JackPortIsTerminal,
-			0
-		);
+		transaction the_transaction(*this);
 		
-		if (0 == port)
-		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Failed to register jack port")
-		}
+		the_transaction.insert_midi_track(track_name, index, sequence_storage);
 		
-		insert_track<sequence_of<midi_event>, midi_track>(track_name, new_song, index, port);
-
-		update_song(new_song);
+		the_transaction.commit();
 	}
 	
 	void teq::rename_track(int index, const std::string name)
 	{
+		const song_ptr the_song = load_song();
+
 		if (true == track_name_exists(name))
 		{
 			LIBTEQ_THROW_RUNTIME_ERROR("Track name already exists: " << name)
 		}
 
-		m_song->check_track_index(index);
+		the_song->check_track_index(index);
 		
 		if (track_type(index) == track::MIDI || track_type(index) == track::CV)
 		{
-			if (0 != jack_port_rename(m_jack_client, (*(m_song->m_track_list))[index].second, name.c_str()))
-			{
-				LIBTEQ_THROW_RUNTIME_ERROR("Failed to set track name")
-			}
+			m_backend->rename_port((*(the_song->m_track_list))[index].second, name);
 		}
 
 		song_ptr new_song = copy_song_deep();
@@ -260,67 +292,55 @@ namespace teq
 		(*new_song->m_track_list)[index].first->m_name = name;
 #if 0
 		write_command_and_wait([this, name, index](){
-			(*(m_song->m_track_list))[index].first.m_name = name;
+			(*(the_song->m_track_list))[index].first.m_name = name;
 		});
 #endif
 	}
 	
-	void teq::insert_cv_track(const std::string track_name, int index)
+	void teq::insert_cv_track(const std::string track_name, int index, sequence::storage sequence_storage)
 	{
-		check_track_name_and_index_for_insert(track_name, index);
-		
-		song_ptr new_song = copy_song_deep();
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
 		
-		jack_port_t *port = jack_port_register
-		(
-			m_jack_client, 
-			track_name.c_str(), 
-			JACK_DEFAULT_AUDIO_TYPE, 
-			JackPortIsOutput | JackPortIsTerminal,
-			0
-		);
+		transaction the_transaction(*this);
 		
-		if (0 == port)
-		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Failed to register jack port")
-		}
+		the_transaction.insert_cv_track(track_name, index, sequence_storage);
 		
-		insert_track<sequence_of<cv_event>, cv_track>(track_name, new_song, index, port);
-
-		update_song(new_song);
+		the_transaction.commit();
 	}
 	
-	void teq::insert_control_track(const std::string track_name, int index)
+	void teq::insert_control_track(const std::string track_name, int index, sequence::storage sequence_storage)
 	{
-		check_track_name_and_index_for_insert(track_name, index);
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
 		
-		song_ptr new_song = copy_song_deep();
-
-		insert_track<sequence_of<control_event>, control_track>(track_name, new_song, index, nullptr);
-
-		update_song(new_song);
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_control_track(track_name, index, sequence_storage);
+		
+		the_transaction.commit();
 	}
 	
 	int teq::number_of_tracks()
 	{
-		return (int)m_song->m_track_list->size();
+		return (int)load_song()->m_track_list->size();
 	}
 	
 	std::string teq::track_name(int index)
 	{
-		return (*m_song->m_track_list)[index].first->m_name;
+		return (*load_song()->m_track_list)[index].first->m_name;
 	}
 	
 	int teq::number_of_patterns()
 	{
-		return (int)m_song->m_pattern_list->size();
+		return (int)load_song()->m_pattern_list->size();
 	}
 	
 	int teq::number_of_ticks(int pattern_index)
 	{
-		m_song->check_pattern_index(pattern_index);
+		const song_ptr the_song = load_song();
+
+		the_song->check_pattern_index(pattern_index);
 		
-		return (*m_song->m_pattern_list)[pattern_index]->m_length;
+		return (*the_song->m_pattern_list)[pattern_index]->m_length;
 	}
 	
 	void teq::remove_track(int index)
@@ -337,12 +357,17 @@ namespace teq
 	}
 	
 	pattern_ptr teq::create_pattern(int pattern_length)
+	{
+		return create_pattern_for_song(*load_song(), pattern_length);
+	}
+	
+	pattern_ptr teq::create_pattern_for_song(const song &the_song, int pattern_length)
 	{
 		pattern_ptr new_pattern(new pattern);
 		
 		new_pattern->m_length = pattern_length;
 		
-		for (auto &it : *m_song->m_track_list)
+		for (auto &it : *the_song.m_track_list)
 		{
 			// std::cout << "Creating track" << std::endl;
 			sequence_ptr new_sequence = it.first->create_sequence();
@@ -355,57 +380,133 @@ namespace teq
 		return new_pattern;
 	}
 	
-	void teq::insert_pattern(int index, const pattern_ptr the_pattern)
-	{	
-		song_ptr new_song = copy_song_top_level_deep();
-		
-		if (index > (int)m_song->m_pattern_list->size())
+	void teq::check_pattern_for_song(const song &the_song, const pattern_ptr the_pattern)
+	{
+		if (the_pattern->m_sequences.size() != the_song.m_track_list->size())
 		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Pattern index out of bounds: " << index << ". Number of patterns: " << number_of_patterns())
+			LIBTEQ_THROW_RUNTIME_ERROR("Pattern does not match the tracks of the song. Number of sequences: " << the_pattern->m_sequences.size() << ". Number of tracks: " << the_song.m_track_list->size())
 		}
+	}
 
-		song::pattern_list_ptr new_pattern_list(new song::pattern_list(*m_song->m_pattern_list));
+	void teq::insert_pattern(int index, const pattern_ptr the_pattern)
+	{	
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
 		
-		new_pattern_list->insert(new_pattern_list->begin() + index, the_pattern);
-
-		// std::cout << "Pattern list has # of entries: " << new_pattern_list->size() << std::endl;
-		write_command_and_wait
-		(
-			[this, new_pattern_list] () mutable
-			{
-				m_song->m_pattern_list = new_pattern_list;
-				new_pattern_list.reset();
-			}
-		);
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_pattern(index, the_pattern);
+		
+		the_transaction.commit();
 	}
 
 	void teq::set_pattern(int index, const pattern_ptr the_pattern)
 	{	
-		song_ptr new_song = copy_song_top_level_deep();
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_pattern(index, the_pattern);
+		
+		the_transaction.commit();
+	}
+
+	template<class EventType>
+	void teq::set_event(int pattern_index, int track_index, int tick_index, const EventType &event)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_event(pattern_index, track_index, tick_index, event);
+		
+		the_transaction.commit();
+	}
+	
+	template void teq::set_event<midi_event>(int, int, int, const midi_event&);
+	template void teq::set_event<cv_event>(int, int, int, const cv_event&);
+	template void teq::set_event<control_event>(int, int, int, const control_event&);
+
+	template<class EventType>
+	void teq::set_column_event(int pattern_index, int track_index, int column_index, int tick_index, const EventType &event)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_column_event(pattern_index, track_index, column_index, tick_index, event);
+		
+		the_transaction.commit();
+	}
+	
+	template void teq::set_column_event<midi_event>(int, int, int, int, const midi_event&);
+	template void teq::set_column_event<cv_event>(int, int, int, int, const cv_event&);
+	template void teq::set_column_event<control_event>(int, int, int, int, const control_event&);
+
+	void teq::set_midi_thru(int track_index, const midi_thru &thru)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_midi_thru(track_index, thru);
+		
+		the_transaction.commit();
+	}
+	
+	midi_thru teq::get_midi_thru(int track_index)
+	{
+		const song_ptr the_song = load_song();
+		
+		the_song->check_track_index(track_index);
+		
+		const track_ptr &the_track = (*the_song->m_track_list)[(size_t)track_index].first;
+		
+		if (track::type::MIDI != the_track->m_type)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Not a midi track: " << track_index)
+		}
+		
+		return std::static_pointer_cast<midi_track>(the_track)->m_thru;
+	}
 
-		if (index >= (int)m_song->m_pattern_list->size())
+	void teq::set_number_of_columns(int track_index, int number_of_columns)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_number_of_columns(track_index, number_of_columns);
+		
+		the_transaction.commit();
+	}
+	
+	int teq::get_number_of_columns(int track_index)
+	{
+		const song_ptr the_song = load_song();
+		
+		the_song->check_track_index(track_index);
+		
+		const track_ptr &the_track = (*the_song->m_track_list)[(size_t)track_index].first;
+		
+		if (track::type::MIDI != the_track->m_type)
 		{
-			LIBTEQ_THROW_RUNTIME_ERROR("Pattern index out of bounds: " << index << ". Number of patterns: " << number_of_patterns())
+			return 1;
 		}
-		song::pattern_list_ptr new_pattern_list(new song::pattern_list(*m_song->m_pattern_list));
 		
-		(*new_pattern_list)[index] = the_pattern;
+		return (int)std::static_pointer_cast<midi_track>(the_track)->m_number_of_columns;
+	}
 
-		// std::cout << "Pattern list has # of entries: " << new_pattern_list->size() << std::endl;
-		write_command_and_wait
-		(
-			[this, new_pattern_list] () mutable
-			{
-				m_song->m_pattern_list = new_pattern_list;
-				new_pattern_list.reset();
-			}
-		);
+	pattern_ptr teq::get_pattern_deep_copy(int index)
+	{
+		return pattern_ptr(new pattern(*get_pattern(index)));
 	}
 
 	pattern_ptr teq::get_pattern(int index)
 	{
-		m_song->check_pattern_index(index);
-		return (*m_song->m_pattern_list)[index];
+		const song_ptr the_song = load_song();
+
+		the_song->check_pattern_index(index);
+		return (*the_song->m_pattern_list)[index];
 	}
 	
 	void teq::remove_pattern(int index)
@@ -426,13 +527,7 @@ namespace teq
 
 	void teq::set_loop_range(const loop_range range)
 	{
-		write_command_and_wait
-		(
-			[this, range]()
-			{
-				this->m_loop_range = range;
-			}
-		);
+		write_command_and_wait(command::set_loop_range(range));
 	}
 	
 	float teq::get_global_tempo()
@@ -442,24 +537,12 @@ namespace teq
 	
 	void teq::set_global_tempo(float tempo)
 	{
-		write_command_and_wait
-		(
-			[this, tempo]()
-			{
-				this->m_global_tempo = tempo;
-			}
-		);
+		write_command_and_wait(command::set_global_tempo(tempo));
 	}	
 	
 	void teq::set_ticks_per_beat(int ticks)
 	{
-		write_command_and_wait
-		(
-			[this, ticks]()
-			{
-				this->m_ticks_per_beat = ticks;
-			}
-		);
+		write_command_and_wait(command::set_ticks_per_beat(ticks));
 	}	
 
 	int teq::get_ticks_per_beat()
@@ -469,13 +552,7 @@ namespace teq
 
 	void teq::set_transport_source(transport_source source)
 	{
-		write_command_and_wait
-		(
-			[this, source]()
-			{
-				this->m_transport_source = source;
-			}
-		);
+		write_command_and_wait(command::set_transport_source(source));
 	}
 
 	transport_source teq::get_transport_source()
@@ -485,109 +562,1459 @@ namespace teq
 
 	void teq::set_transport_state(transport_state state)
 	{
-		write_command_and_wait
-		(
-			[this, state]()
-			{
-				this->m_transport_state = state;
-			}
-		);
+		write_command_and_wait(command::set_transport_state(state));
 	}
 	
 	bool teq::has_state_info()
 	{
-		return m_state_info_buffer.can_read();
+		return m_state_info.sequence() != m_read_state_info_sequence;
 	}
 	
 	teq::state_info teq::get_state_info()
 	{
-		if (true == m_state_info_buffer.can_read())
+		//! The state read is at least as new as this
+		m_read_state_info_sequence = m_state_info.sequence();
+		
+		return m_state_info.read();
+	}
+	
+	void teq::set_tick_events_enabled(bool enabled)
+	{
+		m_tick_events_enabled = enabled;
+	}
+	
+	bool teq::has_tick_event()
+	{
+		return m_tick_event_buffer.can_read();
+	}
+	
+	teq::tick_event teq::get_tick_event()
+	{
+		if (true == m_tick_event_buffer.can_read())
 		{
-			return m_state_info_buffer.read();
+			return m_tick_event_buffer.read();
 		}
 		else
 		{
-			LIBTEQ_THROW_RUNTIME_ERROR("No state info available right now.")
+			LIBTEQ_THROW_RUNTIME_ERROR("No tick event available right now.")
 		}
 	}
 	
-	void teq::set_transport_position(transport_position position)
-	{
-		write_command_and_wait
-		(
-			[this, position]()
-			{
-				this->m_transport_position = position;
-				this->m_time_until_next_tick = 0;
-			}
-		);
-	}
-	
-	void teq::gc()
+	uint64_t teq::dropped_tick_events()
 	{
-		m_song_heap.gc();
+		return m_dropped_tick_events;
 	}
 	
-	void teq::write_command(command f)
+	void teq::start_recording(int track_index, record_mode mode)
 	{
-		if (false == m_command_buffer.can_write())
+		std::unique_lock<std::mutex> lock(m_recording_mutex);
+		
+		const song_ptr the_song = load_song();
+		
+		the_song->check_track_index(track_index);
+		
+		if (track::type::MIDI != (*the_song->m_track_list)[(size_t)track_index].first->m_type)
 		{
-			throw std::runtime_error("Failed to write command");
+			LIBTEQ_THROW_RUNTIME_ERROR("Not a midi track: " << track_index)
 		}
 		
-		m_command_buffer.write(f);
+		//! Whatever is left goes to the track it was recorded for
+		merge_recorded_events();
+		
+		m_recorded_track = track_index;
+		m_record_mode = mode;
+		m_recorded_ticks.clear();
+		m_recorded_ticks_played = 0;
+		m_recorded_note = -1;
+		
+		m_recording_replaces = (REPLACE == mode);
+		m_recording = true;
+		
+		lock.unlock();
+		m_recording_condition_variable.notify_all();
 	}
 	
-	void teq::write_command_and_wait(command f)
+	void teq::stop_recording()
 	{
-		std::unique_lock<std::mutex> lock(m_ack_mutex);
-		m_ack = false;
+		m_recording = false;
 		
-		write_command(f);
+		std::lock_guard<std::mutex> lock(m_recording_mutex);
 		
-		while(false == m_ack)
+		merge_recorded_events();
+		
+		if (m_recording_error)
 		{
-			std::cv_status status = m_ack_condition_variable.wait_for(lock, std::chrono::seconds(1));
-			if (status == std::cv_status::timeout)
-			{
-					LIBTEQ_THROW_RUNTIME_ERROR("Timeout waiting for ack for command. Is jack not running anymore?")
-			}
+			const std::exception_ptr error = m_recording_error;
+			m_recording_error = std::exception_ptr();
+			std::rethrow_exception(error);
 		}
 	}
-
 	
-	void teq::wait()
+	bool teq::is_recording()
 	{
-		write_command_and_wait([](){});
+		return m_recording;
 	}
 	
-	void teq::update_song(song_ptr new_song)
+	uint64_t teq::dropped_recorded_events()
 	{
-		update_transport_lookup_list(new_song);
-
-		write_command_and_wait
-		(
-			[this, new_song] () mutable
-			{
-				m_song = new_song;
-				new_song.reset();
-			}
-		);
+		return m_dropped_recorded_events;
 	}
-
-	void teq::update_transport_lookup_list(song_ptr new_song)
+	
+	void teq::set_transport_position(transport_position position)
 	{
-		
+		write_command_and_wait(command::set_transport_position(position));
 	}
-
-	void teq::render_event(const midi::midi_event &e, void *port_buffer, jack_nframes_t time)
+	
+	int64_t teq::position_to_frame(const transport_position position)
 	{
-		jack_midi_data_t *event_buffer = jack_midi_event_reserve(port_buffer, time, e.size());
-		if (0 == event_buffer)
+		const song_ptr the_song = load_song();
+		
+		the_song->check_tick_index((int)position.m_pattern, (int)position.m_tick);
+		
+		const tick song_tick = (*the_song->m_transport_lookup_list)[(size_t)position.m_pattern] + position.m_tick;
+		
+		const float base_tempo = m_base_global_tempo;
+		
+		const double sample_rate = m_backend->sample_rate();
+		
+		const std::vector<tempo_map::segment> &segments = the_song->m_tempo_map->m_segments;
+		
+		/**
+		 * Add up the tick lengths segment by segment in the fixed 
+		 * point arithmetic of m_tick_clock, so the result is exact to
+		 * the frame.
+		 */
+		int64_t subframes = 0;
+		
+		for (size_t index = 0; index < segments.size() && segments[index].m_tick < song_tick; ++index)
+		{
+			const tick end = (index + 1 < segments.size()) ? std::min(song_tick, segments[index + 1].m_tick) : song_tick;
+			
+			const int64_t ticks = end - segments[index].m_tick;
+			
+			const int64_t length = clock_tick_length(segments[index], base_tempo, sample_rate);
+			
+			if (length > (std::numeric_limits<int64_t>::max() - subframes) / ticks)
+			{
+				//! The tick never fires (e.g. at a tempo of zero)
+				return std::numeric_limits<int64_t>::max() >> tick_clock::fractional_bits;
+			}
+			
+			subframes += ticks * length;
+		}
+		
+		return (subframes + tick_clock::subframes_per_frame - 1) >> tick_clock::fractional_bits;
+	}
+	
+	int64_t teq::clock_tick_length(const tempo_map::segment &the_segment, float base_tempo, double sample_rate)
+	{
+		//! Multiplied in float like the RT thread does
+		const float ticks_per_second = the_segment.m_relative_tempo * (the_segment.m_has_global_tempo ? the_segment.m_global_tempo : base_tempo);
+		
+		return tick_clock::tick_length(ticks_per_second, sample_rate);
+	}
+	
+	transport_position teq::frame_to_position(int64_t frame)
+	{
+		const song_ptr the_song = load_song();
+		
+		if (true == the_song->m_pattern_list->empty())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("The song has no patterns")
+		}
+		
+		if (frame < 0)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Negative frame: " << frame)
+		}
+		
+		const float base_tempo = m_base_global_tempo;
+		
+		const double sample_rate = m_backend->sample_rate();
+		
+		const std::vector<tempo_map::segment> &segments = the_song->m_tempo_map->m_segments;
+		
+		//! A tick fires on frame if its time is at or before this. See position_to_frame()
+		const int64_t target = std::min(frame, std::numeric_limits<int64_t>::max() >> tick_clock::fractional_bits) << tick_clock::fractional_bits;
+		
+		//! The time of the first tick of the current segment, never after target
+		int64_t subframes = 0;
+		
+		tick song_tick = 0;
+		
+		for (size_t index = 0; index < segments.size(); ++index)
+		{
+			const int64_t length = clock_tick_length(segments[index], base_tempo, sample_rate);
+			
+			const int64_t ticks_fired = (target - subframes) / length + 1;
+			
+			if (index + 1 == segments.size() || ticks_fired <= segments[index + 1].m_tick - segments[index].m_tick)
+			{
+				song_tick = segments[index].m_tick + ticks_fired - 1;
+				break;
+			}
+			
+			subframes += (segments[index + 1].m_tick - segments[index].m_tick) * length;
+		}
+		
+		const size_t pattern_index = the_song->find_pattern((double)song_tick);
+		
+		return transport_position((tick)pattern_index, song_tick - (*the_song->m_transport_lookup_list)[pattern_index]);
+	}
+	
+	void teq::gc()
+	{
+		m_song_heap.gc();
+	}
+	
+	uint64_t teq::write_command(const command &the_command)
+	{
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		
+		if (false == m_command_buffer.can_write())
+		{
+			throw std::runtime_error("Failed to write command");
+		}
+		
+		m_command_buffer.write(the_command);
+		
+		return ++m_written_commands;
+	}
+	
+	void teq::write_command_and_wait(const command &the_command)
+	{
+		if (true == m_backend->is_clocked_manually())
+		{
+			/**
+			 * There is no process callback to wait for, so the
+			 * command is executed right away.
+			 */
+			write_command(the_command);
+			process_commands();
+			return;
+		}
+		
+		std::unique_lock<std::mutex> lock(m_ack_mutex);
+		m_ack = false;
+		
+		write_command(the_command);
+		
+		while(false == m_ack)
+		{
+			std::cv_status status = m_ack_condition_variable.wait_for(lock, std::chrono::seconds(1));
+			if (status == std::cv_status::timeout)
+			{
+					LIBTEQ_THROW_RUNTIME_ERROR("Timeout waiting for ack for command. Is the backend not running anymore?")
+			}
+		}
+	}
+
+	
+	std::future<void> teq::write_command_async(const command &the_command, completion_callback callback, std::vector<std::shared_ptr<const void>> keep_alive)
+	{
+		std::unique_lock<std::mutex> lock(m_completion_mutex);
+		
+		pending_completion completion;
+		
+		completion.m_sequence_number = write_command(the_command);
+		completion.m_callback = callback;
+		completion.m_keep_alive = keep_alive;
+		
+		std::future<void> future = completion.m_promise.get_future();
+		
+		m_pending_completions.push_back(std::move(completion));
+		
+		if (true == m_backend->is_clocked_manually())
+		{
+			process_commands();
+			
+			complete_executed_commands(lock);
+		}
+		else
+		{
+			m_completion_condition_variable.notify_all();
+		}
+		
+		return future;
+	}
+	
+	void teq::run_reclamation()
+	{
+		std::unique_lock<std::mutex> lock(m_reclamation_mutex);
+		
+		while (false == m_stop_reclamation_thread)
+		{
+			m_reclamation_condition_variable.wait_for(lock, std::chrono::milliseconds(100));
+			
+			m_song_heap.gc();
+		}
+	}
+	
+	void teq::run_recording()
+	{
+		std::unique_lock<std::mutex> lock(m_recording_mutex);
+		
+		while (false == m_stop_recording_thread)
+		{
+			if (false == m_recording && false == m_recorded_event_buffer.can_read() && true == m_recorded_edits.empty())
+			{
+				m_recording_condition_variable.wait(lock);
+				continue;
+			}
+			
+			/**
+			 * The RT thread must not signal anything, so we poll 
+			 * while recording or retrying.
+			 */
+			m_recording_condition_variable.wait_for(lock, std::chrono::milliseconds(10));
+			
+			merge_recorded_events();
+		}
+	}
+	
+	transport_position teq::next_position(const song &the_song, const loop_range &the_loop_range, transport_position position)
+	{
+		const song::pattern_list &patterns = *the_song.m_pattern_list;
+		
+		transport_position next(position.m_pattern, position.m_tick + 1);
+		
+		if (next.m_tick >= patterns[(size_t)next.m_pattern]->length())
+		{
+			if (next.m_pattern + 1 >= (tick)patterns.size())
+			{
+				return position;
+			}
+			
+			next = transport_position(next.m_pattern + 1, 0);
+		}
+		
+		if (true == the_loop_range.m_enabled && next.m_pattern == the_loop_range.m_end.m_pattern && next.m_tick == the_loop_range.m_end.m_tick)
+		{
+			next = the_loop_range.m_start;
+		}
+		
+		return next;
+	}
+	
+	void teq::merge_recorded_events()
+	{
+		const song_ptr the_song = load_song();
+		
+		const song::pattern_list &patterns = *the_song->m_pattern_list;
+		
+		const loop_range the_loop_range = m_state_info.read().m_loop_range;
+		
+		auto is_in_song = [&patterns](const transport_position &position)
+		{
+			return position.m_pattern >= 0 && position.m_pattern < (tick)patterns.size() && position.m_tick >= 0 && position.m_tick < patterns[(size_t)position.m_pattern]->length();
+		};
+		
+		/**
+		 * First turn the captured events into edits. In REPLACE mode a 
+		 * played tick is cleared unless something was recorded on it 
+		 * in this pass. Events rounded up to the next tick are merged
+		 * before that tick is played, so anything recorded since the 
+		 * previous tick was played belongs to this pass.
+		 */
+		while (true == m_recorded_event_buffer.can_read())
+		{
+			const recorded_event the_recorded_event = m_recorded_event_buffer.read();
+			
+			if (false == is_in_song(the_recorded_event.m_position))
+			{
+				continue;
+			}
+			
+			if (recorded_event::TICK == the_recorded_event.m_type)
+			{
+				++m_recorded_ticks_played;
+				
+				const auto key = std::make_pair(the_recorded_event.m_position.m_pattern, the_recorded_event.m_position.m_tick);
+				
+				auto it = m_recorded_ticks.find(key);
+				
+				if (it != m_recorded_ticks.end())
+				{
+					if (it->second.m_ticks_played + 1 >= m_recorded_ticks_played)
+					{
+						continue;
+					}
+					
+					m_recorded_ticks.erase(it);
+				}
+				
+				m_recorded_edits.push_back(recorded_edit{the_recorded_event.m_position, midi_event()});
+				continue;
+			}
+			
+			midi_event the_event;
+			
+			if (false == decode_message(the_recorded_event.m_message, the_event))
+			{
+				continue;
+			}
+			
+			transport_position position = the_recorded_event.m_position;
+			
+			if (the_recorded_event.m_tick_fraction >= 0.5f)
+			{
+				position = next_position(*the_song, the_loop_range, position);
+			}
+			
+			auto it = m_recorded_ticks.find(std::make_pair(position.m_pattern, position.m_tick));
+			
+			const bool has_recorded_note = (it != m_recorded_ticks.end() && (midi_event::ON == it->second.m_type || midi_event::OFF == it->second.m_type));
+			
+			switch (the_event.m_type)
+			{
+				case midi_event::ON:
+					m_recorded_note = (int)the_event.m_value1;
+					break;
+					
+				case midi_event::OFF:
+					if (m_recorded_note != (int)the_event.m_value1)
+					{
+						continue;
+					}
+					
+					m_recorded_note = -1;
+					
+					//! Do not cut a note on recorded on the same tick
+					if (true == has_recorded_note && midi_event::ON == it->second.m_type)
+					{
+						position = next_position(*the_song, the_loop_range, position);
+					}
+					break;
+					
+				default:
+					if (true == has_recorded_note)
+					{
+						continue;
+					}
+					break;
+			}
+			
+			m_recorded_ticks[std::make_pair(position.m_pattern, position.m_tick)] = recorded_tick{m_recorded_ticks_played, the_event.m_type};
+			
+			m_recorded_edits.push_back(recorded_edit{position, the_event});
+		}
+		
+		if (true == m_recorded_edits.empty())
+		{
+			return;
+		}
+		
+		if (m_recorded_track < 0 || m_recorded_track >= (int)the_song->m_track_list->size() || track::type::MIDI != (*the_song->m_track_list)[(size_t)m_recorded_track].first->m_type)
+		{
+			m_recorded_edits.clear();
+			return;
+		}
+		
+		/**
+		 * Then commit all of them in one go. Only the sequences of the
+		 * recorded track in the touched patterns are copied.
+		 */
+		try
+		{
+			std::lock_guard<std::mutex> edit_lock(m_edit_mutex);
+			
+			transaction the_transaction(*this);
+			
+			for (auto &it : m_recorded_edits)
+			{
+				if (true == is_in_song(it.m_position))
+				{
+					the_transaction.set_event((int)it.m_position.m_pattern, m_recorded_track, (int)it.m_position.m_tick, it.m_event);
+				}
+			}
+			
+			the_transaction.commit();
+			
+			m_recorded_edits.clear();
+		}
+		catch (const std::runtime_error &)
+		{
+			if (load_song() != the_song)
+			{
+				//! The song was changed in the meantime. Try again next time
+				return;
+			}
+			
+			//! Retrying would not help. Report it from stop_recording()
+			m_recording_error = std::current_exception();
+			m_recorded_edits.clear();
+		}
+	}
+	
+	void teq::run_completions()
+	{
+		std::unique_lock<std::mutex> lock(m_completion_mutex);
+		
+		while (false == m_stop_completion_thread)
+		{
+			if (true == m_pending_completions.empty())
+			{
+				m_completion_condition_variable.wait(lock);
+				continue;
+			}
+			
+			if (m_executed_commands.load(std::memory_order_acquire) < m_pending_completions.front().m_sequence_number)
+			{
+				/**
+				 * The RT thread must not block on or signal anything, 
+				 * so we poll while there is something to wait for.
+				 */
+				m_completion_condition_variable.wait_for(lock, std::chrono::milliseconds(1));
+				continue;
+			}
+			
+			complete_executed_commands(lock);
+		}
+	}
+	
+	void teq::complete_executed_commands(std::unique_lock<std::mutex> &lock)
+	{
+		const uint64_t executed_commands = m_executed_commands.load(std::memory_order_acquire);
+		
+		std::vector<pending_completion> completions;
+		
+		while (false == m_pending_completions.empty() && m_pending_completions.front().m_sequence_number <= executed_commands)
+		{
+			completions.push_back(std::move(m_pending_completions.front()));
+			m_pending_completions.pop_front();
+		}
+		
+		lock.unlock();
+		
+		for (auto &it : completions)
+		{
+			try
+			{
+				if (it.m_callback)
+				{
+					it.m_callback();
+				}
+				
+				it.m_promise.set_value();
+			}
+			catch (...)
+			{
+				//! Only this completion failed. The rest of the batch still completes
+				it.m_promise.set_exception(std::current_exception());
+			}
+		}
+		
+		completions.clear();
+		
+		lock.lock();
+	}
+	
+	std::future<void> teq::set_send_all_notes_off_on_loop_async(bool on, completion_callback callback)
+	{
+		return write_command_async(command::set_send_all_notes_off_on_loop(on), callback);
+	}
+	
+	std::future<void> teq::set_send_all_notes_off_on_stop_async(bool on, completion_callback callback)
+	{
+		return write_command_async(command::set_send_all_notes_off_on_stop(on), callback);
+	}
+	
+	std::future<void> teq::insert_midi_track_async(const std::string track_name, int index, sequence::storage sequence_storage, completion_callback callback)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_midi_track(track_name, index, sequence_storage);
+		
+		return the_transaction.commit_async(callback);
+	}
+	
+	std::future<void> teq::insert_cv_track_async(const std::string track_name, int index, sequence::storage sequence_storage, completion_callback callback)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_cv_track(track_name, index, sequence_storage);
+		
+		return the_transaction.commit_async(callback);
+	}
+	
+	std::future<void> teq::insert_control_track_async(const std::string track_name, int index, sequence::storage sequence_storage, completion_callback callback)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_control_track(track_name, index, sequence_storage);
+		
+		return the_transaction.commit_async(callback);
+	}
+	
+	std::future<void> teq::insert_pattern_async(int index, const pattern_ptr the_pattern, completion_callback callback)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.insert_pattern(index, the_pattern);
+		
+		return the_transaction.commit_async(callback);
+	}
+	
+	std::future<void> teq::set_pattern_async(int index, const pattern_ptr the_pattern, completion_callback callback)
+	{
+		std::lock_guard<std::mutex> lock(m_edit_mutex);
+		
+		transaction the_transaction(*this);
+		
+		the_transaction.set_pattern(index, the_pattern);
+		
+		return the_transaction.commit_async(callback);
+	}
+	
+	std::future<void> teq::set_loop_range_async(const loop_range range, completion_callback callback)
+	{
+		return write_command_async(command::set_loop_range(range), callback);
+	}
+	
+	std::future<void> teq::set_global_tempo_async(float tempo, completion_callback callback)
+	{
+		return write_command_async(command::set_global_tempo(tempo), callback);
+	}
+	
+	std::future<void> teq::set_ticks_per_beat_async(int ticks, completion_callback callback)
+	{
+		return write_command_async(command::set_ticks_per_beat(ticks), callback);
+	}
+	
+	std::future<void> teq::set_transport_state_async(transport_state state, completion_callback callback)
+	{
+		return write_command_async(command::set_transport_state(state), callback);
+	}
+	
+	std::future<void> teq::set_transport_source_async(transport_source source, completion_callback callback)
+	{
+		return write_command_async(command::set_transport_source(source), callback);
+	}
+	
+	std::future<void> teq::set_transport_position_async(transport_position position, completion_callback callback)
+	{
+		return write_command_async(command::set_transport_position(position), callback);
+	}
+	
+	teq::transaction::transaction(teq &the_teq) :
+		m_teq(the_teq),
+		m_base_song(the_teq.load_song()),
+		m_state(new transaction_state),
+		m_committed(false),
+		m_published(false)
+	{
+
+	}
+
+	teq::transaction::~transaction()
+	{
+		if (true == m_published)
+		{
+			return;
+		}
+		
+		//! No song refers to them, so the RT thread does not use them
+		for (auto the_port : m_registered_ports)
+		{
+			try
+			{
+				m_teq.m_backend->unregister_port(the_port);
+			}
+			catch (const std::exception &)
+			{
+				
+			}
+		}
+	}
+
+	song &teq::transaction::current_song()
+	{
+		if (m_song)
+		{
+			return *m_song;
+		}
+
+		return *m_base_song;
+	}
+
+	song_ptr teq::transaction::edit_song()
+	{
+		if (!m_song)
+		{
+			m_song = m_teq.copy_song_top_level_deep();
+		}
+
+		return m_song;
+	}
+
+	void teq::transaction::check_open()
+	{
+		if (true == m_committed)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Transaction was already committed")
+		}
+
+		if (m_teq.load_song() != m_base_song)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("The song was changed outside of the transaction")
+		}
+	}
+
+	void teq::transaction::check_track_name_and_index_for_insert(const std::string &track_name, int index)
+	{
+		check_open();
+
+		if (true == current_song().track_name_exists(track_name))
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Track name already exists: " << track_name)
+		}
+		
+		if (index < 0 || index > number_of_tracks())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Track index out of bounds: " << index << ". Number of tracks: " << number_of_tracks())
+		}
+	}
+
+	int teq::transaction::number_of_tracks()
+	{
+		return (int)current_song().m_track_list->size();
+	}
+
+	int teq::transaction::number_of_patterns()
+	{
+		return (int)current_song().m_pattern_list->size();
+	}
+
+	pattern_ptr teq::transaction::create_pattern(int length)
+	{
+		return create_pattern_for_song(current_song(), length);
+	}
+
+	void teq::transaction::insert_midi_track(const std::string track_name, int index, sequence::storage sequence_storage)
+	{
+		check_track_name_and_index_for_insert(track_name, index);
+		
+		song_ptr new_song = edit_song();
+		
+		backend::port *port = m_teq.m_backend->register_port(track_name, backend::port_type::MIDI_OUTPUT);
+		
+		m_registered_ports.push_back(port);
+		
+		insert_track<midi_track>(track_name, sequence_storage, new_song, index, port);
+	}
+
+	void teq::transaction::insert_cv_track(const std::string track_name, int index, sequence::storage sequence_storage)
+	{
+		check_track_name_and_index_for_insert(track_name, index);
+		
+		song_ptr new_song = edit_song();
+		
+		backend::port *port = m_teq.m_backend->register_port(track_name, backend::port_type::AUDIO_OUTPUT);
+		
+		m_registered_ports.push_back(port);
+		
+		insert_track<cv_track>(track_name, sequence_storage, new_song, index, port);
+	}
+
+	void teq::transaction::insert_control_track(const std::string track_name, int index, sequence::storage sequence_storage)
+	{
+		check_track_name_and_index_for_insert(track_name, index);
+		
+		song_ptr new_song = edit_song();
+
+		insert_track<control_track>(track_name, sequence_storage, new_song, index, nullptr);
+	}
+
+	void teq::transaction::mark_private(const pattern_ptr the_pattern)
+	{
+		m_private_patterns.insert(the_pattern);
+		
+		for (auto &it : the_pattern->m_sequences)
+		{
+			m_private_sequences.insert(it);
+		}
+	}
+
+	void teq::transaction::insert_pattern(int index, const pattern_ptr the_pattern)
+	{
+		check_open();
+
+		if (index < 0 || index > number_of_patterns())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Pattern index out of bounds: " << index << ". Number of patterns: " << number_of_patterns())
+		}
+
+		check_pattern_for_song(current_song(), the_pattern);
+
+		song_ptr new_song = edit_song();
+		
+		/**
+		 * The caller keeps the_pattern and might edit it in place. A
+		 * copy also gets a schedule of its own, while the_pattern might
+		 * still have a (stale) one cached by its address.
+		 */
+		const pattern_ptr the_copy(new pattern(*the_pattern));
+		
+		mark_private(the_copy);
+		
+		new_song->m_pattern_list->insert(new_song->m_pattern_list->begin() + index, the_copy);
+	}
+
+	void teq::transaction::set_pattern(int index, const pattern_ptr the_pattern)
+	{
+		check_open();
+
+		if (index < 0 || index >= number_of_patterns())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Pattern index out of bounds: " << index << ". Number of patterns: " << number_of_patterns())
+		}
+
+		check_pattern_for_song(current_song(), the_pattern);
+
+		song_ptr new_song = edit_song();
+		
+		//! See insert_pattern()
+		const pattern_ptr the_copy(new pattern(*the_pattern));
+		
+		mark_private(the_copy);
+		
+		(*new_song->m_pattern_list)[index] = the_copy;
+	}
+
+	template<class EventType>
+	void teq::transaction::set_event(int pattern_index, int track_index, int tick_index, const EventType &event)
+	{
+		set_column_event(pattern_index, track_index, 0, tick_index, event);
+	}
+
+	template void teq::transaction::set_event<midi_event>(int, int, int, const midi_event&);
+	template void teq::transaction::set_event<cv_event>(int, int, int, const cv_event&);
+	template void teq::transaction::set_event<control_event>(int, int, int, const control_event&);
+
+	template<class EventType>
+	void teq::transaction::set_column_event(int pattern_index, int track_index, int column_index, int tick_index, const EventType &event)
+	{
+		check_open();
+
+		current_song().check_tick_index(pattern_index, tick_index);
+
+		current_song().check_track_index(track_index);
+
+		(*current_song().m_pattern_list)[(size_t)pattern_index]->check_column_index(track_index, column_index);
+
+		song_ptr new_song = edit_song();
+
+		pattern_ptr &the_pattern = (*new_song->m_pattern_list)[(size_t)pattern_index];
+
+		if (0 == m_private_patterns.count(the_pattern))
+		{
+			the_pattern = the_pattern->copy_sharing_sequences();
+			m_private_patterns.insert(the_pattern);
+		}
+
+		sequence_ptr &the_sequence = the_pattern->m_sequences[(size_t)track_index];
+
+		if (0 == m_private_sequences.count(the_sequence))
+		{
+			the_sequence = the_sequence->clone();
+			m_private_sequences.insert(the_sequence);
+		}
+
+		the_pattern->set_column_event(track_index, column_index, tick_index, event);
+
+		// The sequence might have been converted to the other representation
+		m_private_sequences.insert(the_sequence);
+	}
+
+	template void teq::transaction::set_column_event<midi_event>(int, int, int, int, const midi_event&);
+	template void teq::transaction::set_column_event<cv_event>(int, int, int, int, const cv_event&);
+	template void teq::transaction::set_column_event<control_event>(int, int, int, int, const control_event&);
+
+	void teq::transaction::set_midi_thru(int track_index, const midi_thru &thru)
+	{
+		check_open();
+		
+		current_song().check_track_index(track_index);
+		
+		if (track::type::MIDI != (*current_song().m_track_list)[(size_t)track_index].first->m_type)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Not a midi track: " << track_index)
+		}
+		
+		song_ptr new_song = edit_song();
+		
+		track_ptr &the_track = (*new_song->m_track_list)[(size_t)track_index].first;
+		
+		//! Other song versions share the track, so it is replaced by a copy
+		std::shared_ptr<midi_track> new_track(new midi_track(*std::static_pointer_cast<midi_track>(the_track)));
+		
+		new_track->m_thru = thru;
+		
+		the_track = new_track;
+	}
+
+	void teq::transaction::set_number_of_columns(int track_index, int number_of_columns)
+	{
+		check_open();
+		
+		current_song().check_track_index(track_index);
+		
+		if (track::type::MIDI != (*current_song().m_track_list)[(size_t)track_index].first->m_type)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Not a midi track: " << track_index)
+		}
+		
+		if (number_of_columns < 1 || number_of_columns > (int)midi_track::max_number_of_columns)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Number of columns out of range: " << number_of_columns << ". Maximum: " << midi_track::max_number_of_columns)
+		}
+		
+		song_ptr new_song = edit_song();
+		
+		track_ptr &the_track = (*new_song->m_track_list)[(size_t)track_index].first;
+		
+		std::shared_ptr<midi_track> new_track(new midi_track(*std::static_pointer_cast<midi_track>(the_track)));
+		
+		new_track->m_number_of_columns = (unsigned)number_of_columns;
+		
+		the_track = new_track;
+		
+		/**
+		 * The kept columns are shared with the old sequences. The new
+		 * sequences are not private, so editing them later in this
+		 * transaction clones them first.
+		 */
+		for (auto &the_pattern : *new_song->m_pattern_list)
+		{
+			if (0 == m_private_patterns.count(the_pattern))
+			{
+				the_pattern = the_pattern->copy_sharing_sequences();
+				m_private_patterns.insert(the_pattern);
+			}
+			
+			std::vector<sequence_ptr> columns;
+			
+			for (int column_index = 0; column_index < number_of_columns; ++column_index)
+			{
+				if (column_index < the_pattern->number_of_columns(track_index))
+				{
+					columns.push_back(the_pattern->column(track_index, column_index));
+				}
+				else
+				{
+					columns.push_back(create_sequence_of<midi_event>(new_track->m_sequence_storage));
+					columns.back()->set_length((unsigned)the_pattern->m_length);
+				}
+			}
+			
+			sequence_ptr &the_sequence = the_pattern->m_sequences[(size_t)track_index];
+			
+			if (1 == number_of_columns)
+			{
+				if (columns[0]->m_muted != the_sequence->m_muted)
+				{
+					columns[0] = columns[0]->clone();
+					columns[0]->m_muted = the_sequence->m_muted;
+				}
+				
+				the_sequence = columns[0];
+			}
+			else
+			{
+				std::shared_ptr<column_sequence> new_sequence(new column_sequence(new_track->m_sequence_storage));
+				
+				new_sequence->m_muted = the_sequence->m_muted;
+				new_sequence->m_columns = columns;
+				
+				the_sequence = new_sequence;
+			}
+		}
+	}
+
+	void teq::transaction::set_loop_range(const loop_range range)
+	{
+		check_open();
+
+		m_state->m_set_loop_range = true;
+		m_state->m_loop_range = range;
+	}
+
+	void teq::transaction::set_global_tempo(float tempo)
+	{
+		check_open();
+
+		m_state->m_set_global_tempo = true;
+		m_state->m_global_tempo = tempo;
+	}
+
+	void teq::transaction::set_ticks_per_beat(int ticks)
+	{
+		check_open();
+
+		m_state->m_set_ticks_per_beat = true;
+		m_state->m_ticks_per_beat = ticks;
+	}
+
+	void teq::transaction::set_transport_state(transport_state state)
+	{
+		check_open();
+
+		m_state->m_set_transport_state = true;
+		m_state->m_transport_state = state;
+	}
+
+	void teq::transaction::set_transport_source(transport_source source)
+	{
+		check_open();
+
+		m_state->m_set_transport_source = true;
+		m_state->m_transport_source = source;
+	}
+
+	void teq::transaction::set_transport_position(transport_position position)
+	{
+		check_open();
+
+		m_state->m_set_transport_position = true;
+		m_state->m_transport_position = position;
+	}
+
+	void teq::transaction::set_send_all_notes_off_on_loop(bool on)
+	{
+		check_open();
+
+		m_state->m_set_send_all_notes_off_on_loop = true;
+		m_state->m_send_all_notes_off_on_loop = on;
+	}
+
+	void teq::transaction::set_send_all_notes_off_on_stop(bool on)
+	{
+		check_open();
+
+		m_state->m_set_send_all_notes_off_on_stop = true;
+		m_state->m_send_all_notes_off_on_stop = on;
+	}
+
+	void teq::transaction::prepare_commit()
+	{
+		check_open();
+
+		if (m_song)
+		{
+			m_teq.compile_song(m_song);
+		}
+	}
+
+	void teq::transaction::publish_song()
+	{
+		m_committed = true;
+
+		if (m_song)
+		{
+			m_teq.publish_song(m_song);
+		}
+		
+		m_published = true;
+	}
+
+	void teq::transaction::commit()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_teq.m_publish_mutex);
+			
+			prepare_commit();
+			
+			publish_song();
+		}
+
+		/**
+		 * The RT thread picks up the song at the start of the next
+		 * period without us waiting for it. It picks up the latest
+		 * song only after executing the commands, so the settings 
+		 * never take effect before the song.
+		 *
+		 * m_state is kept alive by the pending completion of the 
+		 * command, not by us, so giving up on waiting is safe.
+		 */
+		if (true == m_state->changes_settings())
+		{
+			std::vector<std::shared_ptr<const void>> keep_alive;
+			keep_alive.push_back(m_state);
+			
+			std::future<void> future = m_teq.write_command_async(command::commit_transaction(m_state.get()), completion_callback(), keep_alive);
+			
+			if (std::future_status::timeout == future.wait_for(std::chrono::seconds(1)))
+			{
+				LIBTEQ_THROW_RUNTIME_ERROR("Timeout waiting for ack for command. Is the backend not running anymore?")
+			}
+		}
+	}
+
+	std::future<void> teq::transaction::commit_async(completion_callback callback)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_teq.m_publish_mutex);
+			
+			prepare_commit();
+			
+			publish_song();
+		}
+
+		std::vector<std::shared_ptr<const void>> keep_alive;
+		keep_alive.push_back(m_state);
+
+		/**
+		 * Without settings we still send an empty command to learn 
+		 * when the RT thread has picked up the song.
+		 */
+		return m_teq.write_command_async(m_state->changes_settings() ? command::commit_transaction(m_state.get()) : command::none(), callback, keep_alive);
+	}
+
+	void teq::wait()
+	{
+		write_command_and_wait(command::none());
+	}
+	
+	void teq::update_song(song_ptr new_song)
+	{
+		compile_song(new_song);
+
+		publish_song(new_song);
+	}
+
+	void teq::publish_song(song_ptr new_song)
+	{
+		std::atomic_store(&m_song, m_song_heap.publish(new_song));
+	}
+
+	song_ptr teq::load_song()
+	{
+		return std::atomic_load(&m_song);
+	}
+
+	void teq::compile_song(song_ptr new_song)
+	{
+		update_transport_lookup_list(new_song);
+
+		update_schedule_list(new_song);
+
+		update_tempo_map(new_song);
+
+		update_track_view(new_song);
+	}
+
+	void teq::update_track_view(song_ptr new_song)
+	{
+		const song_ptr the_song = load_song();
+
+		const track_view &previous_view = *the_song->m_track_view;
+		
+		//! Tracks are identified by their ports (see find_previous_index())
+		std::map<const backend::port*, int> previous_indices;
+		
+		for (size_t index = 0; index < previous_view.m_midi_tracks.size(); ++index)
+		{
+			previous_indices[previous_view.m_midi_tracks.m_ports[index]] = (int)index;
+		}
+		
+		for (size_t index = 0; index < previous_view.m_cv_tracks.size(); ++index)
+		{
+			previous_indices[previous_view.m_cv_tracks.m_ports[index]] = (int)index;
+		}
+		
+		track_view_ptr new_view(new track_view);
+		
+		for (auto &it : *new_song->m_track_list)
+		{
+			auto previous_index = previous_indices.find(it.second);
+			
+			const int previous_index_or_none = (previous_index == previous_indices.end()) ? -1 : previous_index->second;
+			
+			switch (it.first->m_type)
+			{
+				case track::type::MIDI:
+					new_view->m_midi_tracks.push_back((const midi_track*)it.first.get(), it.second, previous_index_or_none);
+					break;
+					
+				case track::type::CV:
+					new_view->m_cv_tracks.push_back((const cv_track*)it.first.get(), it.second, previous_index_or_none);
+					break;
+					
+				default:
+					break;
+			}
+		}
+		
+		new_view->m_midi_tracks.build_thru_table();
+		
+		new_song->m_track_view = new_view;
+	}
+
+	void teq::update_transport_lookup_list(song_ptr new_song)
+	{
+		const song::pattern_list &patterns = *new_song->m_pattern_list;
+
+		song::transport_lookup_list_ptr new_list(new song::transport_lookup_list);
+
+		new_list->reserve(patterns.size() + 1);
+
+		tick start = 0;
+
+		for (auto &it : patterns)
+		{
+			new_list->push_back(start);
+			start += it->length();
+		}
+
+		new_list->push_back(start);
+
+		new_song->m_transport_lookup_list = new_list;
+	}
+
+	void teq::update_tempo_map(song_ptr new_song)
+	{
+		std::shared_ptr<tempo_map> new_map(new tempo_map);
+
+		bool has_global_tempo = false;
+		float global_tempo = 0;
+		float relative_tempo = 1;
+
+		const song::schedule_list &schedules = *new_song->m_schedule_list;
+
+		const song::transport_lookup_list &pattern_starts = *new_song->m_transport_lookup_list;
+
+		for (size_t pattern_index = 0; pattern_index < schedules.size(); ++pattern_index)
+		{
+			const auto &schedule = schedules[pattern_index]->m_control_events;
+
+			for (size_t tick_index = 0; tick_index + 1 < schedule.m_tick_offsets.size(); ++tick_index)
+			{
+				if (schedule.m_tick_offsets[tick_index] == schedule.m_tick_offsets[tick_index + 1])
+				{
+					continue;
+				}
+
+				for (uint32_t index = schedule.m_tick_offsets[tick_index]; index < schedule.m_tick_offsets[tick_index + 1]; ++index)
+				{
+					const control_event &the_event = schedule.m_entries[index].m_event;
+
+					switch (the_event.m_type)
+					{
+						case control_event::type::GLOBAL_TEMPO:
+							has_global_tempo = true;
+							global_tempo = the_event.m_value;
+							break;
+
+						case control_event::type::RELATIVE_TEMPO:
+							relative_tempo = the_event.m_value;
+							break;
+
+						default:
+							break;
+					}
+				}
+
+				new_map->change_tempo(pattern_starts[pattern_index] + (tick)tick_index, has_global_tempo, global_tempo, relative_tempo);
+			}
+		}
+
+		new_song->m_tempo_map = new_map;
+	}
+
+	//! For internal use only!
+	template<class EventType>
+	void compile_event_schedule(event_schedule<EventType> &schedule, const pattern &the_pattern, const song::track_list &tracks, track::type the_type)
+	{
+		schedule.m_tick_offsets.resize((size_t)the_pattern.m_length + 1);
+		
+		std::vector<uint32_t> type_indices;
+		std::vector<size_t> track_indices;
+		
+		uint32_t type_index = 0;
+		
+		for (size_t track_index = 0; track_index < tracks.size(); ++track_index)
+		{
+			if (the_type == tracks[track_index].first->m_type)
+			{
+				type_indices.push_back(type_index++);
+				track_indices.push_back(track_index);
+			}
+		}
+		
+		/**
+		 * Dense and sparse sequences are both walked track by track 
+		 * (and column by column) in tick order. The first pass counts
+		 * the events per tick, the second one puts them in place. 
+		 * Within a tick the entries are ordered by track and column.
+		 */
+		std::vector<uint32_t> &offsets = schedule.m_tick_offsets;
+		
+		std::fill(offsets.begin(), offsets.end(), 0);
+		
+		for (auto track_index : track_indices)
+		{
+			for_each_column_event<EventType>(*the_pattern.m_sequences[track_index], [&offsets](unsigned, unsigned tick_index, const EventType &) { ++offsets[tick_index]; });
+		}
+		
+		uint32_t number_of_entries = 0;
+		
+		for (auto &offset : offsets)
+		{
+			const uint32_t count = offset;
+			offset = number_of_entries;
+			number_of_entries += count;
+		}
+		
+		schedule.m_entries.resize(number_of_entries);
+		
+		std::vector<uint32_t> positions(offsets);
+		
+		for (size_t index = 0; index < track_indices.size(); ++index)
+		{
+			const uint32_t the_type_index = type_indices[index];
+			
+			for_each_column_event<EventType>
+			(
+				*the_pattern.m_sequences[track_indices[index]],
+				[&schedule, &positions, the_type_index](unsigned column_index, unsigned tick_index, const EventType &the_event)
+				{
+					auto &the_entry = schedule.m_entries[positions[tick_index]++];
+					
+					the_entry.m_type_index = the_type_index;
+					the_entry.m_column = column_index;
+					the_entry.m_event = the_event;
+				}
+			);
+		}
+	}
+
+	void teq::update_schedule_list(song_ptr new_song)
+	{
+		const song_ptr the_song = load_song();
+
+		const song::track_list &tracks = *new_song->m_track_list;
+		const song::pattern_list &patterns = *new_song->m_pattern_list;
+		
+		/**
+		 * The schedules refer to the tracks by index, so they can only
+		 * be reused if the tracks are the very same.
+		 */
+		const bool same_tracks = (tracks == *the_song->m_track_list);
+		
+		std::map<const pattern*, pattern_schedule_ptr> previous_schedules;
+		
+		if (true == same_tracks)
+		{
+			for (size_t index = 0; index < the_song->m_schedule_list->size() && index < the_song->m_pattern_list->size(); ++index)
+			{
+				previous_schedules[(*the_song->m_pattern_list)[index].get()] = (*the_song->m_schedule_list)[index];
+			}
+		}
+		
+		song::schedule_list_ptr new_schedule_list(new song::schedule_list);
+		
+		for (auto &the_pattern : patterns)
+		{
+			auto it = previous_schedules.find(the_pattern.get());
+			
+			if (it != previous_schedules.end())
+			{
+				new_schedule_list->push_back(it->second);
+				continue;
+			}
+			
+			std::shared_ptr<pattern_schedule> schedule(new pattern_schedule);
+			
+			compile_event_schedule(schedule->m_midi_events, *the_pattern, tracks, track::type::MIDI);
+			compile_event_schedule(schedule->m_cv_events, *the_pattern, tracks, track::type::CV);
+			compile_event_schedule(schedule->m_control_events, *the_pattern, tracks, track::type::CONTROL);
+			
+			new_schedule_list->push_back(schedule);
+		}
+		
+		new_song->m_schedule_list = new_schedule_list;
+	}
+
+	bool teq::encode_event(const midi_event &the_event, unsigned char channel, midi::message &the_message)
+	{
+		switch(the_event.m_type)
 		{
-			return;
+			case midi_event::CC:
+				the_message = midi::cc(channel, (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2);
+				return true;
+				
+			case midi_event::PITCHBEND:
+				the_message = midi::pitch_bend(channel, the_event.m_value1);
+				return true;
+				
+			case midi_event::AFTERTOUCH:
+				the_message = midi::polyphonic_aftertouch(channel, (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2);
+				return true;
+				
+			case midi_event::CHANNEL_PRESSURE:
+				the_message = midi::channel_pressure(channel, (unsigned char)the_event.m_value1);
+				return true;
+				
+			case midi_event::PROGRAM_CHANGE:
+				the_message = midi::program_change(channel, (unsigned char)the_event.m_value1);
+				return true;
+				
+			default:
+				return false;
+		}
+	}
+	
+	bool teq::decode_message(const midi::message &the_message, midi_event &the_event)
+	{
+		if (the_message.m_size < 2)
+		{
+			return false;
+		}
+		
+		const unsigned value1 = the_message.m_data[1] & 0x7f;
+		const unsigned value2 = (the_message.m_size > 2) ? (the_message.m_data[2] & 0x7f) : 0;
+		
+		switch (the_message.m_data[0] & 0xf0)
+		{
+			case midi::NOTE_ON:
+				the_event = (0 == value2) ? midi_event(midi_event::OFF, value1) : midi_event(midi_event::ON, value1, value2);
+				return true;
+				
+			case midi::NOTE_OFF:
+				the_event = midi_event(midi_event::OFF, value1);
+				return true;
+				
+			case midi::CONTROL_CHANGE:
+				the_event = midi_event(midi_event::CC, value1, value2);
+				return true;
+				
+			case midi::PITCH_BEND:
+				the_event = midi_event(midi_event::PITCHBEND, value1 | (value2 << 7));
+				return true;
+				
+			case midi::POLYPHONIC_AFTERTOUCH:
+				the_event = midi_event(midi_event::AFTERTOUCH, value1, value2);
+				return true;
+				
+			case midi::CHANNEL_PRESSURE:
+				the_event = midi_event(midi_event::CHANNEL_PRESSURE, value1);
+				return true;
+				
+			case midi::PROGRAM_CHANGE:
+				the_event = midi_event(midi_event::PROGRAM_CHANGE, value1);
+				return true;
+				
+			default:
+				return false;
 		}
-		e.render(event_buffer);
 	}
 	
 	void teq::process_commands()
@@ -596,12 +2023,25 @@ namespace teq
 		{
 			std::unique_lock<std::mutex> lock(m_ack_mutex, std::try_to_lock);
 			
+			uint64_t executed_commands = 0;
+			
 			while(m_command_buffer.can_read())
 			{
-				m_command_buffer.snoop()();
+				execute_command(m_command_buffer.snoop());
 				m_command_buffer.read_advance();
+				++executed_commands;
 			}
 			
+			/**
+			 * After the commands, so the settings of a transaction 
+			 * never take effect before its song.
+			 */
+			m_song_heap.enter();
+			switch_song(m_song_heap.latest());
+			m_song_heap.leave();
+			
+			m_executed_commands.fetch_add(executed_commands, std::memory_order_release);
+			
 			m_ack = true;
 			
 			m_ack_condition_variable.notify_all();
@@ -612,178 +2052,583 @@ namespace teq
 		}		
 	}
 		
-	void teq::fetch_port_buffers(jack_nframes_t nframes)
+	void teq::execute_command(const command &the_command)
+	{
+		switch (the_command.m_type)
+		{
+			case command::NONE:
+				break;
+
+			case command::SET_LOOP_RANGE:
+				m_loop_range = the_command.get_loop_range();
+				break;
+
+			case command::SET_GLOBAL_TEMPO:
+				m_global_tempo = the_command.m_tempo;
+				m_base_global_tempo = the_command.m_tempo;
+				break;
+
+			case command::SET_TICKS_PER_BEAT:
+				m_ticks_per_beat = the_command.m_ticks;
+				break;
+
+			case command::SET_TRANSPORT_SOURCE:
+				m_transport_source = the_command.m_transport_source;
+				break;
+
+			case command::SET_TRANSPORT_STATE:
+				m_transport_state = the_command.m_transport_state;
+				break;
+
+			case command::SET_TRANSPORT_POSITION:
+				m_transport_position = the_command.get_transport_position();
+				m_tick_clock.reset();
+				m_has_played_tick = false;
+				transport_jumped();
+				break;
+
+			case command::SET_SEND_ALL_NOTES_OFF_ON_LOOP:
+				m_send_all_notes_off_on_loop = the_command.m_on;
+				break;
+
+			case command::SET_SEND_ALL_NOTES_OFF_ON_STOP:
+				m_send_all_notes_off_on_stop = the_command.m_on;
+				break;
+
+			case command::COMMIT_TRANSACTION:
+				apply_transaction_state(*the_command.m_transaction_state);
+				break;
+		}
+	}
+
+	void teq::switch_song(song *new_song)
+	{
+		if (new_song == m_rt_song)
+		{
+			return;
+		}
+
+		new_song->m_track_view->transfer_state(*m_rt_song->m_track_view);
+		m_rt_song = new_song;
+		m_song_heap.set_in_use(m_rt_song);
+	}
+
+	void teq::apply_transaction_state(const transaction_state &state)
+	{
+		if (true == state.m_set_loop_range)
+		{
+			m_loop_range = state.m_loop_range;
+		}
+
+		if (true == state.m_set_global_tempo)
+		{
+			m_global_tempo = state.m_global_tempo;
+			m_base_global_tempo = state.m_global_tempo;
+		}
+
+		if (true == state.m_set_ticks_per_beat)
+		{
+			m_ticks_per_beat = state.m_ticks_per_beat;
+		}
+
+		if (true == state.m_set_transport_source)
+		{
+			m_transport_source = state.m_transport_source;
+		}
+
+		if (true == state.m_set_transport_state)
+		{
+			m_transport_state = state.m_transport_state;
+		}
+
+		if (true == state.m_set_transport_position)
+		{
+			m_transport_position = state.m_transport_position;
+			m_tick_clock.reset();
+			transport_jumped();
+		}
+
+		if (true == state.m_set_send_all_notes_off_on_loop)
+		{
+			m_send_all_notes_off_on_loop = state.m_send_all_notes_off_on_loop;
+		}
+
+		if (true == state.m_set_send_all_notes_off_on_stop)
+		{
+			m_send_all_notes_off_on_stop = state.m_send_all_notes_off_on_stop;
+		}
+	}
+		
+	void teq::fetch_port_buffers(nframes_t nframes)
 	{
-		for (size_t track_index = 0; track_index < m_song->m_track_list->size(); ++track_index)
+		midi_track_view &midi_tracks = m_rt_song->m_track_view->m_midi_tracks;
+		
+		for (size_t index = 0; index < midi_tracks.size(); ++index)
 		{
-			auto &track_properties = *(*m_song->m_track_list)[track_index].first;
-			jack_port_t *port = (*m_song->m_track_list)[track_index].second;
+			midi_tracks.m_port_buffers[index] = m_backend->get_buffer(midi_tracks.m_ports[index], nframes);
 			
-			switch(track_properties.m_type)
+			m_backend->clear_midi_buffer(midi_tracks.m_port_buffers[index]);
+		}
+		
+		cv_track_view &cv_tracks = m_rt_song->m_track_view->m_cv_tracks;
+		
+		for (size_t index = 0; index < cv_tracks.size(); ++index)
+		{
+			cv_tracks.m_port_buffers[index] = (float*)m_backend->get_buffer(cv_tracks.m_ports[index], nframes);
+		}
+		
+		m_midi_in_buffer = m_backend->get_buffer(m_midi_in_port, nframes);
+	}
+	
+	void teq::process_midi_input(int64_t end_frame, uint32_t &event_index)
+	{
+		const midi_track_view &midi_tracks = m_rt_song->m_track_view->m_midi_tracks;
+		
+		const midi_thru_table &thru_table = midi_tracks.m_thru_table;
+		
+		const bool recording = m_recording.load(std::memory_order_relaxed) && m_transport_state == transport_state::PLAYING;
+		
+		if (false == recording && true == thru_table.empty())
+		{
+			return;
+		}
+		
+		const uint32_t number_of_events = m_backend->get_midi_event_count(m_midi_in_buffer);
+		
+		backend::midi_input_event the_input_event;
+		
+		for (; event_index < number_of_events; ++event_index)
+		{
+			if (false == m_backend->get_midi_event(m_midi_in_buffer, event_index, the_input_event))
 			{
-				case track::type::CV:
+				continue;
+			}
+			
+			if ((int64_t)the_input_event.m_time >= end_frame)
+			{
+				break;
+			}
+			
+			//! Only channel voice messages are passed on and recorded
+			if (the_input_event.m_size < 2 || the_input_event.m_size > 3 || the_input_event.m_data[0] < 0x80 || the_input_event.m_data[0] >= 0xf0)
+			{
+				continue;
+			}
+			
+			const midi::message the_message = midi::message{{the_input_event.m_data[0], the_input_event.m_data[1], (unsigned char)((3 == the_input_event.m_size) ? the_input_event.m_data[2] : 0)}, (unsigned char)the_input_event.m_size};
+			
+			const size_t status_index = (size_t)(the_message.m_data[0] - 0x80);
+			
+			for (uint32_t route_index = thru_table.m_status_offsets[status_index]; route_index < thru_table.m_status_offsets[status_index + 1]; ++route_index)
+			{
+				const midi_thru_table::route &the_route = thru_table.m_routes[route_index];
+				
+				midi::message routed_message = the_message;
+				
+				if (true == midi_thru_table::apply(the_route, routed_message))
 				{
-					auto &properties = *((cv_track*)&track_properties);
-					
-					properties.m_port_buffer = jack_port_get_buffer(port, nframes);
+					m_backend->write_midi_messages(midi_tracks.m_port_buffers[the_route.m_track_index], the_input_event.m_time, &routed_message, 1);
 				}
-				break;
+			}
+			
+			if (false == recording)
+			{
+				continue;
+			}
+			
+			recorded_event the_recorded_event;
+			
+			the_recorded_event.m_type = recorded_event::MESSAGE;
+			
+			if (true == m_has_played_tick)
+			{
+				the_recorded_event.m_position = m_last_played_position;
+				
+				const double subframes = (double)(((int64_t)the_input_event.m_time - m_last_tick_frame) * tick_clock::subframes_per_frame);
+				
+				the_recorded_event.m_tick_fraction = (float)std::min(0.999, std::max(0.0, subframes / (double)m_tick_clock.m_tick_length));
+			}
+			else
+			{
+				//! Nothing was played yet, so this belongs to the first tick
+				the_recorded_event.m_position = m_transport_position;
+				the_recorded_event.m_tick_fraction = 0;
+			}
+			
+			the_recorded_event.m_message = the_message;
+			
+			if (true == m_recorded_event_buffer.can_write())
+			{
+				m_recorded_event_buffer.write(the_recorded_event);
+			}
+			else
+			{
+				m_dropped_recorded_events.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
 
-				case track::type::MIDI:
+	void teq::process_until(int64_t end_frame, uint32_t &input_event_index, void *multi_out_buffer)
+	{
+		while (false == m_note_off_queue.empty())
+		{
+			const int64_t frame = std::max((int64_t)0, m_note_off_queue.top().m_frame - m_period_start_frame);
+			
+			if (frame >= end_frame)
+			{
+				break;
+			}
+			
+			process_midi_input(frame, input_event_index);
+			
+			send_note_off(m_note_off_queue.top(), (nframes_t)frame, multi_out_buffer);
+			
+			m_note_off_queue.pop();
+		}
+		
+		process_midi_input(end_frame, input_event_index);
+	}
+	
+	void teq::send_note_off(const note_off_queue::entry &the_entry, nframes_t frame, void *multi_out_buffer)
+	{
+		midi_track_view &midi_tracks = m_rt_song->m_track_view->m_midi_tracks;
+		
+		const midi::message the_message = midi::note_off(the_entry.m_channel, the_entry.m_note, 127);
+		
+		//! The track might have moved or be gone since the note started
+		for (size_t track_index = 0; track_index < midi_tracks.size(); ++track_index)
+		{
+			if (midi_tracks.m_ports[track_index] == the_entry.m_port)
+			{
+				m_backend->write_midi_messages(midi_tracks.m_port_buffers[track_index], frame, &the_message, 1);
+				midi_tracks.m_sounding_notes[track_index].erase(the_entry.m_channel, the_entry.m_note);
+				
+				//! So neither the next note on nor an OFF in its column ends it again
+				midi_tracks.m_voices[track_index].release(the_entry.m_note);
+				break;
+			}
+		}
+		
+		const midi::message multi_message = midi::with_channel(the_message, the_entry.m_multi_channel);
+		
+		m_backend->write_midi_messages(multi_out_buffer, frame, &multi_message, 1);
+	}
+	
+	void teq::send_sounding_note_offs(nframes_t frame, void *multi_out_buffer)
+	{
+		midi_track_view &midi_tracks = m_rt_song->m_track_view->m_midi_tracks;
+		
+		midi::message_batch<128> multi_out_batch;
+		
+		for (size_t track_index = 0; track_index < midi_tracks.size(); ++track_index)
+		{
+			sounding_notes &notes = midi_tracks.m_sounding_notes[track_index];
+			
+			//! So the next note on in a column does not end its note again
+			midi_tracks.m_voices[track_index] = midi_track_view::voice_table();
+			
+			if (true == notes.empty())
+			{
+				continue;
+			}
+			
+			const unsigned char multi_channel = (unsigned char)(track_index % 16);
+			
+			midi::message_batch<128> out_batch;
+			
+			notes.for_each
+			(
+				[&](unsigned char channel, unsigned char note)
 				{
-					auto &properties = *((midi_track*)&track_properties);
+					if (true == out_batch.full())
+					{
+						m_backend->write_midi_messages(midi_tracks.m_port_buffers[track_index], frame, out_batch.m_messages, out_batch.m_size);
+						out_batch.clear();
+					}
 					
-					properties.m_port_buffer = jack_port_get_buffer(port, nframes);
+					if (true == multi_out_batch.full())
+					{
+						m_backend->write_midi_messages(multi_out_buffer, frame, multi_out_batch.m_messages, multi_out_batch.m_size);
+						multi_out_batch.clear();
+					}
 					
-					jack_midi_clear_buffer(properties.m_port_buffer);
+					out_batch.push_back(midi::note_off(channel, note, 127));
+					multi_out_batch.push_back(midi::note_off(multi_channel, note, 127));
 				}
-				break;
-
-				default:
-					break;
-			}
+			);
+			
+			m_backend->write_midi_messages(midi_tracks.m_port_buffers[track_index], frame, out_batch.m_messages, out_batch.m_size);
+			
+			notes.clear();
+		}
+		
+		m_backend->write_midi_messages(multi_out_buffer, frame, multi_out_batch.m_messages, multi_out_batch.m_size);
+		
+		//! All the notes they would end just ended
+		m_note_off_queue.clear();
+	}
+	
+	void teq::transport_jumped()
+	{
+		m_note_off_queue.cut_at(m_period_start_frame);
+		
+		if (true == m_send_all_notes_off_on_loop)
+		{
+			m_note_offs_pending = true;
 		}
 	}
 
-	void teq::write_cv_ports(int frame_index)
+	void teq::write_cv_ports(nframes_t frame_index, nframes_t nframes, int64_t frames_until_next_tick, bool rolling)
 	{
 		/**
-			* Write out CV values. This has to happen for every single frame
-			* since it's a continous signal as opposed to the event based 
-			* midi and control signals
+			* CV is a continous signal as opposed to the event based midi
+			* and control signals. It is rendered in blocks between tick 
+			* boundaries since its value can only change on ticks.
 			*/
-		for (size_t track_index = 0; track_index < m_song->m_track_list->size(); ++track_index)
+		cv_track_view &cv_tracks = m_rt_song->m_track_view->m_cv_tracks;
+		
+		for (size_t index = 0; index < cv_tracks.size(); ++index)
 		{
-			auto &track_properties = *(*m_song->m_track_list)[track_index].first;
+			float *buffer = cv_tracks.m_port_buffers[index] + frame_index;
 			
-			switch(track_properties.m_type)
+			float &current_value = cv_tracks.m_current_values[index];
+			float &ramp_increment = cv_tracks.m_ramp_increments[index];
+			int64_t &ramp_frames_left = cv_tracks.m_ramp_frames_left[index];
+			
+			//! frames_until_next_tick means nothing then
+			if (false == rolling)
 			{
-				case track::type::CV:
+				kernels::fill(buffer, nframes, current_value);
+				continue;
+			}
+			
+			if (ramp_frames_left < 0)
+			{
+				ramp_frames_left = std::max((int64_t)1, frames_until_next_tick);
+				
+				ramp_increment = (cv_tracks.m_ramp_end_values[index] - current_value) / (float)ramp_frames_left;
+			}
+			
+			nframes_t ramp_frames = (nframes_t)std::min((int64_t)nframes, ramp_frames_left);
+			
+			if (ramp_frames > 0)
+			{
+				kernels::ramp(buffer, ramp_frames, current_value, ramp_increment);
+				
+				ramp_frames_left -= ramp_frames;
+				
+				if (0 == ramp_frames_left)
+				{
+					current_value = cv_tracks.m_ramp_end_values[index];
+				}
+				else
+				{
+					current_value += (float)ramp_frames * ramp_increment;
+				}
+			}
+			
+			kernels::fill(buffer + ramp_frames, nframes - ramp_frames, current_value);
+		}
+	}
+	
+	void teq::process_tick(transport_position position, nframes_t frame, void *multi_out_buffer, const std::vector<pattern_ptr> &patterns)
+	{
+		if (m_transport_position.m_pattern >= (tick)patterns.size())
+		{
+			return;
+		}
+		
+		const pattern_schedule &the_schedule = *(*m_rt_song->m_schedule_list)[(size_t)m_transport_position.m_pattern];
+		const size_t current_tick = (size_t)m_transport_position.m_tick;
+		
+		/**
+		 * Control events go first, so that tempo changes are in effect
+		 * for everything else happening on this tick.
+		 */
+		{
+			const auto &schedule = the_schedule.m_control_events;
+			
+			for (uint32_t index = schedule.m_tick_offsets[current_tick]; index < schedule.m_tick_offsets[current_tick + 1]; ++index)
+			{
+				const auto &the_event = schedule.m_entries[index].m_event;
+				
+				switch (the_event.m_type)
+				{
+					case control_event::type::GLOBAL_TEMPO:
+						m_global_tempo = the_event.m_value;
+						break;
+						
+					case control_event::type::RELATIVE_TEMPO:
+						m_relative_tempo = the_event.m_value;
+						break;
+						
+					default: 
+						break;
+				}
+			}
+		}
+		
+		{
+			const auto &schedule = the_schedule.m_cv_events;
+			cv_track_view &cv_tracks = m_rt_song->m_track_view->m_cv_tracks;
+			
+			for (uint32_t index = schedule.m_tick_offsets[current_tick]; index < schedule.m_tick_offsets[current_tick + 1]; ++index)
+			{
+				const auto &the_event = schedule.m_entries[index].m_event;
+				const uint32_t track_index = schedule.m_entries[index].m_type_index;
+				
+				switch (the_event.m_type)
 				{
-					auto &cv_properties = *((cv_track*)&track_properties);
-					
-					((float*)(cv_properties.m_port_buffer))[frame_index] = cv_properties.m_current_value;
+					case cv_event::type::CONSTANT:
+						cv_tracks.m_current_values[track_index] = the_event.m_value1;
+						cv_tracks.m_ramp_frames_left[track_index] = 0;
+						break;
+						
+					case cv_event::type::INTERVAL:
+						cv_tracks.m_current_values[track_index] = the_event.m_value1;
+						cv_tracks.m_ramp_end_values[track_index] = the_event.m_value2;
+						cv_tracks.m_ramp_frames_left[track_index] = -1;
+						break;
+						
+					default:
+						break;
 				}
-				break;
-
-				default:
-					break;
 			}
 		}
-	}
-	
-	void teq::process_tick(transport_position position, jack_nframes_t frame, void *multi_out_buffer, const std::vector<pattern_ptr> &patterns)
-	{
-		const pattern &the_pattern = *patterns[(size_t)m_transport_position.m_pattern];
-		const tick current_tick = m_transport_position.m_tick;
-		
-		int midi_track_index = 0;
 		
-		for (size_t track_index = 0; track_index < m_song->m_track_list->size() && m_transport_position.m_pattern < (int)m_song->m_pattern_list->size(); ++track_index)
 		{
-			auto &track_properties = *(*m_song->m_track_list)[track_index].first;
+			const auto &schedule = the_schedule.m_midi_events;
+			midi_track_view &midi_tracks = m_rt_song->m_track_view->m_midi_tracks;
 			
-			switch(track_properties.m_type)
+			/**
+			 * Everything that goes out on the multi port on this tick is 
+			 * collected here and written in one go.
+			 */
+			midi::message_batch<128> multi_out_batch;
+			
+			for (uint32_t index = schedule.m_tick_offsets[current_tick]; index < schedule.m_tick_offsets[current_tick + 1]; ++index)
 			{
-				case track::type::MIDI:
+				const auto &the_event = schedule.m_entries[index].m_event;
+				const uint32_t track_index = schedule.m_entries[index].m_type_index;
+				const unsigned char multi_channel = (unsigned char)(track_index % 16);
+				
+				const unsigned char channel = midi_tracks.m_channels[track_index];
+				signed char &last_note = midi_tracks.m_voices[track_index].m_notes[schedule.m_entries[index].m_column];
+				
+				midi::message messages[3];
+				size_t number_of_messages = 0;
+					
+				switch(the_event.m_type)
 				{
-					const auto &the_sequence = *std::static_pointer_cast<sequence_of<midi_event>>(the_pattern.m_sequences[track_index]);
-					auto &properties = *((midi_track*)&track_properties);
-
-					const auto &the_event = the_sequence.m_events[(size_t)current_tick];
-
-					midi_event last_note_on_event = properties.m_last_note_on_event;
+					case midi_event::NONE:
+						break;
 						
-					switch(the_event.m_type)
+					case midi_event::ON:
 					{
-						case midi_event::NONE:
-							break;
+						const unsigned char note = (unsigned char)the_event.m_value1;
+						
+						bool sent_note_off = false;
+						
+						if (midi_tracks.m_note_off_on_new_note_on[track_index] && last_note >= 0)
+						{
+							messages[number_of_messages++] = midi::note_off(channel, (unsigned char)last_note, 127);
+							
+							sent_note_off = (note == last_note);
 							
-						case midi_event::ON:
-							if (properties.m_note_off_on_new_note_on &&last_note_on_event.m_type == midi_event::ON)
+							const int cut_note_off = m_note_off_queue.find(midi_tracks.m_ports[track_index], channel, (unsigned char)last_note);
+							
+							if (cut_note_off >= 0)
 							{
-								
-								render_event(midi::midi_note_off_event(properties.m_channel, (unsigned char)last_note_on_event.m_value1, 127), properties.m_port_buffer, frame);
+								m_note_off_queue.remove((size_t)cut_note_off);
+							}
+						}
+						
+						//! A retriggered note ends before it starts again, not some time after
+						const int pending_note_off = m_note_off_queue.find(midi_tracks.m_ports[track_index], channel, note);
+						
+						if (pending_note_off >= 0)
+						{
+							if (false == sent_note_off)
+							{
+								messages[number_of_messages++] = midi::note_off(channel, note, 127);
 							}
 							
-							render_event(midi::midi_note_on_event(properties.m_channel, (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2), properties.m_port_buffer, frame);
-
-							render_event(midi::midi_note_on_event((unsigned char)(midi_track_index % 16), (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2), multi_out_buffer, frame);
-							
-							properties.m_last_note_on_event = midi_event(midi_event::ON, the_event.m_value1, the_event.m_value2);
-							break;
+							m_note_off_queue.remove((size_t)pending_note_off);
+						}
+						
+						messages[number_of_messages++] = midi::note_on(channel, note, (unsigned char)the_event.m_value2);
+						
+						if (the_event.m_length > 0)
+						{
+							const double frames = (double)the_event.m_length * m_tick_clock.m_sample_rate / ((double)m_relative_tempo * (double)m_global_tempo);
 							
-						case midi_event::OFF:
-							if (properties.m_last_note_on_event.m_type == midi_event::ON)
+							//! Also false for infinite lengths at a tempo of zero
+							if (frames < 1e15)
 							{
-								render_event(midi::midi_note_off_event(properties.m_channel, (unsigned char)properties.m_last_note_on_event.m_value1, 127), properties.m_port_buffer, frame);
+								if (true == m_note_off_queue.full())
+								{
+									//! Better end a note early than never
+									send_note_off(m_note_off_queue.top(), frame, multi_out_buffer);
+									m_note_off_queue.pop();
+								}
 								
-								render_event(midi::midi_note_off_event((unsigned char)(midi_track_index % 16), (unsigned char)properties.m_last_note_on_event.m_value1, 127), multi_out_buffer, frame);
+								m_note_off_queue.push(note_off_queue::entry{m_period_start_frame + (int64_t)frame + std::max((int64_t)1, (int64_t)llround(frames)), midi_tracks.m_ports[track_index], channel, multi_channel, note});
 							}
-							break;
+						}
+						
+						last_note = (signed char)note;
+						break;
+					}
+						
+					case midi_event::OFF:
+						if (last_note >= 0)
+						{
+							messages[number_of_messages++] = midi::note_off(channel, (unsigned char)last_note, 127);
 							
-						case midi_event::CC:
-							render_event(midi::midi_cc_event(properties.m_channel, (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2), properties.m_port_buffer, frame);
-
-							render_event(midi::midi_cc_event((unsigned char)(midi_track_index % 16), (unsigned char)the_event.m_value1, (unsigned char)the_event.m_value2), multi_out_buffer, frame);
-							break;
+							//! The note is over, so its timed note off must not end a later one
+							const int pending_note_off = m_note_off_queue.find(midi_tracks.m_ports[track_index], channel, (unsigned char)last_note);
 							
-						case midi_event::PITCHBEND:
-							break;
-					}
-					
-					++midi_track_index;
+							if (pending_note_off >= 0)
+							{
+								m_note_off_queue.remove((size_t)pending_note_off);
+							}
+							
+							last_note = -1;
+						}
+						break;
+						
+					default:
+						if (true == encode_event(the_event, channel, messages[number_of_messages]))
+						{
+							++number_of_messages;
+						}
+						break;
 				}
-				break;
-					
-				case track::type::CV:
+				
+				m_backend->write_midi_messages(midi_tracks.m_port_buffers[track_index], frame, messages, number_of_messages);
+				
+				for (size_t message_index = 0; message_index < number_of_messages; ++message_index)
 				{
-					const auto &the_sequence = *std::static_pointer_cast<sequence_of<cv_event>>(the_pattern.m_sequences[track_index]);
-					auto &cv_properties = *((cv_track*)&track_properties);
-					const auto &the_previous_event = cv_properties.m_current_event;
-					
-					if (cv_event::type::INTERVAL == the_previous_event.m_type)
+					if (true == multi_out_batch.full())
 					{
-						cv_properties.m_current_value = the_previous_event.m_value2;
+						m_backend->write_midi_messages(multi_out_buffer, frame, multi_out_batch.m_messages, multi_out_batch.m_size);
+						multi_out_batch.clear();
 					}
 					
-					const auto &the_event = the_sequence.m_events[(size_t)current_tick];
-					cv_properties.m_current_event = the_event;
-				}
-				break;
-
-				case track::type::CONTROL:
-				{
-					const auto &the_sequence = *std::static_pointer_cast<sequence_of<control_event>>(the_pattern.m_sequences[track_index]);
-					const auto &the_event = the_sequence.m_events[(size_t)current_tick];
+					multi_out_batch.push_back(midi::with_channel(messages[message_index], multi_channel));
 					
-					switch (the_event.m_type)
-					{
-						case control_event::type::GLOBAL_TEMPO:
-							m_global_tempo = the_event.m_value;
-							break;
-							
-						case control_event::type::RELATIVE_TEMPO:
-							m_relative_tempo = the_event.m_value;
-							break;
-							
-						default: 
-							break;
-					}
+					midi_tracks.m_sounding_notes[track_index].update(messages[message_index]);
 				}
-				break;
-
-				default:
-					break;
 			}
 			
-			
+			m_backend->write_midi_messages(multi_out_buffer, frame, multi_out_batch.m_messages, multi_out_batch.m_size);
 		}
-		
 	}
 	
-	void teq::advance_transport_by_one_tick(const song::pattern_list &patterns)
+	bool teq::advance_transport_by_one_tick(const song::pattern_list &patterns)
 	{
+		bool looped = false;
+		
 		/** 
 			Safeguard around being off the song..
 		*/
@@ -814,6 +2659,8 @@ namespace teq
 				//std::cout << "loop end" << std::endl;
 				m_transport_position.m_pattern = m_loop_range.m_start.m_pattern;
 				m_transport_position.m_tick = m_loop_range.m_start.m_tick;
+				
+				looped = true;
 			}
 			
 			/**
@@ -824,106 +2671,89 @@ namespace teq
 			{
 				m_transport_state = transport_state::STOPPED;
 				// std::cout << "end" << std::endl;
-				return;
+				return looped;
 			}
 		}
+		
+		return looped;
 	}
 	
-	int teq::process(jack_nframes_t nframes)
+	int teq::process(nframes_t nframes)
 	{
-		//std::cout << ".";
-		if (true == m_state_info_buffer.can_write())
-		{
-			//std::cout << ".";
-			state_info info;
-			
-			info.m_transport_position = m_transport_position;
-			info.m_transport_state = m_transport_state;
-			info.m_loop_range = m_loop_range;
-			info.m_frame_time = jack_last_frame_time(m_jack_client);
-			info.m_is_tick = false;
-			
-			m_state_info_buffer.write(info);
-		}
-		
 		process_commands();
 		
-		const double sample_duration = 1.0 / jack_get_sample_rate(m_jack_client);
+		const double sample_rate = m_backend->sample_rate();
 		
-		void *multi_out_buffer = jack_port_get_buffer(m_multi_out_port, nframes);
-		jack_midi_clear_buffer(multi_out_buffer);
+		void *multi_out_buffer = m_backend->get_buffer(m_multi_out_port, nframes);
+		m_backend->clear_midi_buffer(multi_out_buffer);
 		
 		fetch_port_buffers(nframes);		
 		
 		
-		jack_transport_state_t jack_transport_state;
-		jack_position_t jack_position;
 		tick frame_in_song = 0;
 		
-		const std::vector<pattern_ptr> &patterns = *m_song->m_pattern_list;
+		const std::vector<pattern_ptr> &patterns = *m_rt_song->m_pattern_list;
 		
 		if (m_transport_source == transport_source::JACK_TRANSPORT)
 		{
 			// m_loop_range.m_enabled = false;
 			
-			jack_transport_state = jack_transport_query(m_jack_client, &jack_position);
+			const backend::transport_info backend_transport = m_backend->query_transport();
 			
-			if (jack_transport_state != JackTransportRolling)
+			if (false == backend_transport.m_rolling)
 			{
 				m_transport_state = transport_state::STOPPED;
 			}
 			
-			if ((m_last_jack_transport_state != JackTransportRolling || m_last_jack_position.frame + nframes != jack_position.frame)&& jack_transport_state == JackTransportRolling)
+			if ((false == m_last_backend_transport.m_rolling || m_last_backend_transport.m_frame + nframes != backend_transport.m_frame) && true == backend_transport.m_rolling)
 			{
 				m_transport_state = transport_state::PLAYING;
 				
-				frame_in_song = jack_position.frame;
+				transport_jumped();
 				
-				double time_in_song = (double)frame_in_song / jack_get_sample_rate(m_jack_client);
+				frame_in_song = backend_transport.m_frame;
 				
-				double ticks_per_second = 0;
-				if (jack_position.valid & JackPositionBBT)
-				{
-					ticks_per_second = ((double)m_ticks_per_beat * (jack_position.beats_per_minute / 60.0));
-				}
-				else
+				const double time_in_song = (double)frame_in_song / sample_rate;
+				
+				/**
+				 * JACK's tempo replaces the tempo set with 
+				 * set_global_tempo(). GLOBAL_TEMPO events still win.
+				 */
+				double base_tempo = m_base_global_tempo;
+				if (true == backend_transport.m_has_beats_per_minute)
 				{
-					ticks_per_second = m_global_tempo;
+					base_tempo = ((double)m_ticks_per_beat * (backend_transport.m_beats_per_minute / 60.0));
 				}
 				
+				const tempo_map &the_tempo_map = *m_rt_song->m_tempo_map;
 				
-				m_global_tempo = (float)ticks_per_second;
+				const double tick_time_in_song = the_tempo_map.seconds_to_tick(time_in_song, base_tempo);
 				
-				double tick_time_in_song = time_in_song  * ticks_per_second;
+				//! The tempo that takes the song to the next tick
+				const tempo_map::segment &the_segment = the_tempo_map.segment_before(ceil(tick_time_in_song));
 				
-				double tick_duration = 1.0 / ticks_per_second;
+				m_global_tempo = (float)(the_segment.m_has_global_tempo ? (double)the_segment.m_global_tempo : base_tempo);
+				m_relative_tempo = the_segment.m_relative_tempo;
 				
-				//! Find the pattern - O(number_of_patterns) :(
-
 				if (patterns.size() > 0)
 				{
-					m_transport_position.m_pattern = 0;
+					//! Find the pattern - O(log(number_of_patterns))
+					m_transport_position.m_pattern = (tick)m_rt_song->find_pattern(tick_time_in_song);
 
-					bool in_range = false;
-					while(tick_time_in_song >= 0 && m_transport_position.m_pattern < (tick)patterns.size())
-					{
-						tick_time_in_song -= (double)patterns[(size_t)m_transport_position.m_pattern]->length();
-						in_range = true;
-						++m_transport_position.m_pattern;
-					}
-					
-					if (true == in_range)
-					{
-						--m_transport_position.m_pattern;
-					}
+					//! Find the next tick to be processed and the time until it fires
 					
-					//! Find the tick 
+					const double tick_time_in_pattern = tick_time_in_song - (double)(*m_rt_song->m_transport_lookup_list)[(size_t)m_transport_position.m_pattern];
 					
-					double tick_time_in_pattern = tick_time_in_song + (double)patterns[(size_t)m_transport_position.m_pattern]->length();
+					m_transport_position.m_tick = (tick)ceil(tick_time_in_pattern);
 					
-					m_transport_position.m_tick = (tick)floor(tick_time_in_pattern);
+					m_tick_clock.set_tempo(m_relative_tempo * m_global_tempo, sample_rate);
+					m_tick_clock.reset((double)m_transport_position.m_tick - tick_time_in_pattern);
 					
-					m_time_until_next_tick = tick_duration * (tick_time_in_pattern - (double)m_transport_position.m_tick);
+					if (m_transport_position.m_tick >= patterns[(size_t)m_transport_position.m_pattern]->length())
+					{
+						m_transport_position.m_tick = 0;
+						++m_transport_position.m_pattern;
+					}
 				}
 				else
 				{
@@ -932,52 +2762,330 @@ namespace teq
 				}
 			}
 			
-			m_last_jack_transport_state = jack_transport_state;
-			m_last_jack_position = jack_position;
+			m_last_backend_transport = backend_transport;
 		}
 		
 		// std::cout << (long long)multi_out_buffer << std::endl;
 		
-		for (jack_nframes_t frame_index = 0; frame_index < nframes; ++frame_index)
-		{
-			const float tick_duration = 1.0f / (m_relative_tempo * m_global_tempo);
+		process_frames(nframes, sample_rate, multi_out_buffer, m_backend->last_frame_time(), patterns);
 
+		state_info info;
+		
+		info.m_transport_position = m_transport_position;
+		info.m_transport_state = m_transport_state;
+		info.m_loop_range = m_loop_range;
+		info.m_frame_time = m_backend->last_frame_time() + nframes;
+		
+		m_state_info.write(info);
+		
+		m_period_start_frame += (int64_t)nframes;
+
+		return 0;
+	}
+	
+	void teq::process_frames(nframes_t nframes, double sample_rate, void *multi_out_buffer, nframes_t frame_time, const song::pattern_list &patterns)
+	{
+		m_tick_clock.set_tempo(m_relative_tempo * m_global_tempo, sample_rate);
+		
+		nframes_t frame_index = 0;
+		
+		//! The next event of the "in" port to process
+		uint32_t input_event_index = 0;
+		
+		if (m_transport_state != transport_state::PLAYING)
+		{
+			m_has_played_tick = false;
+			
+			//! Stopped since the last period
+			if (m_last_transport_state == transport_state::PLAYING)
+			{
+				m_stop_frame = m_period_start_frame;
+			}
+		}
+		else
+		{
+			m_stop_frame = -1;
+		}
+		
+		/**
+		 * Jump from tick to tick. Here come all the state transitions 
+		 * that depend on the ticks and not individual frames.
+		 */
+		while (m_transport_state == transport_state::PLAYING)
+		{
+			const int64_t tick_frame = m_tick_clock.next_tick_frame();
+			
+			if (tick_frame >= (int64_t)nframes)
+			{
+				break;
+			}
+			
+			//! Note offs on the tick go out before its note ons
+			process_until(tick_frame + 1, input_event_index, multi_out_buffer);
+			
+			if (true == m_note_offs_pending)
+			{
+				send_sounding_note_offs((nframes_t)tick_frame, multi_out_buffer);
+				m_note_offs_pending = false;
+			}
+			
+			write_cv_ports(frame_index, (nframes_t)tick_frame - frame_index, tick_frame - frame_index, m_relative_tempo * m_global_tempo > 0);
+			
+			frame_index = (nframes_t)tick_frame;
+			
+			process_tick(m_transport_position, frame_index, multi_out_buffer, patterns);
+			
+			if (true == m_recording.load(std::memory_order_relaxed) && true == m_recording_replaces.load(std::memory_order_relaxed))
+			{
+				if (true == m_recorded_event_buffer.can_write())
+				{
+					m_recorded_event_buffer.write(recorded_event{recorded_event::TICK, m_transport_position, 0, midi::message()});
+				}
+				else
+				{
+					m_dropped_recorded_events.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			
+			m_last_played_position = m_transport_position;
+			m_last_tick_frame = tick_frame;
+			m_has_played_tick = true;
+			
+			if (true == m_tick_events_enabled.load(std::memory_order_relaxed))
+			{
+				if (true == m_tick_event_buffer.can_write())
+				{
+					m_tick_event_buffer.write(tick_event{m_transport_position, frame_time + frame_index});
+				}
+				else
+				{
+					m_dropped_tick_events.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			
+			const bool looped = advance_transport_by_one_tick(patterns);
+			
 			/**
-			 * Here come all the state transitions that depend on the ticks
-			 * and not individual frames.
+			 * The tick might have carried a tempo change. This is a no-op
+			 * otherwise.
 			 */
-			if (m_transport_state == transport_state::PLAYING && m_time_until_next_tick <= 0.001)
+			m_tick_clock.set_tempo(m_relative_tempo * m_global_tempo, sample_rate);
+			
+			m_tick_clock.advance();
+			
+			//! Ran out of the end of the song. The last tick still sounds for its full length
+			if (m_transport_state != transport_state::PLAYING)
+			{
+				m_stop_frame = m_period_start_frame + ((m_relative_tempo * m_global_tempo > 0) ? m_tick_clock.next_tick_frame() : tick_frame);
+			}
+			
+			//! Notes reaching over the loop end are cut short on the loop start
+			if (true == looped)
+			{
+				m_note_off_queue.cut_at(m_period_start_frame + m_tick_clock.next_tick_frame());
+				
+				if (true == m_send_all_notes_off_on_loop)
+				{
+					m_note_offs_pending = true;
+				}
+			}
+		}
+		
+		write_cv_ports(frame_index, nframes - frame_index, m_tick_clock.next_tick_frame() - frame_index, m_transport_state == transport_state::PLAYING && m_relative_tempo * m_global_tempo > 0);
+		
+		/**
+		 * Notes do not outlast the transport. They are ended once, on
+		 * the frame the transport stopped, which might only come in a 
+		 * later period.
+		 */
+		if (m_transport_state != transport_state::PLAYING)
+		{
+			nframes_t stop_frame = frame_index;
+			
+			bool stopping = false;
+			
+			if (m_stop_frame >= 0 && m_stop_frame < m_period_start_frame + (int64_t)nframes)
+			{
+				stop_frame = (nframes_t)std::max((int64_t)frame_index, m_stop_frame - m_period_start_frame);
+				
+				m_note_off_queue.cut_at(m_period_start_frame + stop_frame);
+				
+				m_stop_frame = -1;
+				
+				stopping = true;
+			}
+			
+			if ((true == stopping && true == m_send_all_notes_off_on_stop) || (m_stop_frame < 0 && true == m_note_offs_pending))
 			{
-				process_tick(m_transport_position, frame_index, multi_out_buffer, patterns);
+				process_until(stop_frame, input_event_index, multi_out_buffer);
+				
+				send_sounding_note_offs(stop_frame, multi_out_buffer);
+				m_note_offs_pending = false;
+			}
+		}
+		
+		m_last_transport_state = m_transport_state;
+		
+		process_until(nframes, input_event_index, multi_out_buffer);
+		
+		if (m_transport_state == transport_state::PLAYING)
+		{
+			m_tick_clock.end_period(nframes);
+			
+			m_last_tick_frame -= (int64_t)nframes;
+		}
+	}
+	
+	nframes_t teq::render
+	(
+		const std::string &midi_file_name,
+		const std::string &wav_file_name_prefix,
+		nframes_t sample_rate,
+		nframes_t period_size
+	)
+	{
+		const song_ptr the_song = load_song();
 
-				m_time_until_next_tick += tick_duration;
+		std::shared_ptr<null_backend> the_null_backend = std::dynamic_pointer_cast<null_backend>(m_backend);
+		
+		if (!the_null_backend)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("render() is only available on instances running on a null_backend")
+		}
+		
+		if (0 == sample_rate || 0 == period_size)
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Invalid sample rate or period size: " << sample_rate << ", " << period_size)
+		}
+		
+		the_null_backend->set_sample_rate(sample_rate);
+		
+		if (period_size > the_null_backend->buffer_size())
+		{
+			the_null_backend->set_buffer_size(period_size);
+		}
+		
+		process_commands();
+		
+		const song::pattern_list &patterns = *the_song->m_pattern_list;
+		const song::track_list &tracks = *the_song->m_track_list;
+		
+		if (m_transport_position.m_pattern < 0 || m_transport_position.m_pattern >= (tick)patterns.size())
+		{
+			LIBTEQ_THROW_RUNTIME_ERROR("Transport position is not inside the song: " << m_transport_position.m_pattern)
+		}
+		
+		std::vector<offline_midi_buffer> midi_buffers(tracks.size());
+		std::vector<std::vector<float>> cv_buffers(tracks.size());
+		
+		const loop_range the_loop_range = m_loop_range;
+		m_loop_range.m_enabled = false;
+		
+		const transport_source the_transport_source = m_transport_source;
+		m_transport_source = transport_source::INTERNAL;
+		
+		const transport_state the_transport_state = m_transport_state;
+		const transport_position the_transport_position = m_transport_position;
+		const float the_global_tempo = m_global_tempo;
+		const float the_relative_tempo = m_relative_tempo;
+		
+		//! Puts everything back the way it was before rendering
+		auto restore = [&]()
+		{
+			m_transport_state = the_transport_state;
+			m_transport_position = the_transport_position;
+			m_global_tempo = the_global_tempo;
+			m_relative_tempo = the_relative_tempo;
+			m_loop_range = the_loop_range;
+			m_transport_source = the_transport_source;
+			m_last_transport_state = the_transport_state;
+			m_stop_frame = -1;
+			m_tick_clock.reset();
+			
+			state_info info = m_state_info.read();
+			
+			info.m_transport_position = m_transport_position;
+			info.m_transport_state = m_transport_state;
+			info.m_loop_range = m_loop_range;
+			
+			m_state_info.write(info);
+		};
+		
+		const double beats_per_second = m_global_tempo / (double)m_ticks_per_beat;
+		
+		m_transport_state = transport_state::PLAYING;
+		m_tick_clock.reset();
+		
+		nframes_t frame_time = 0;
+		
+		//! After the end of the song the notes of its last ticks still run out
+		while ((m_transport_state == transport_state::PLAYING && m_transport_position.m_pattern < (tick)patterns.size()) || m_stop_frame >= 0 || false == m_note_off_queue.empty())
+		{
+			//! The song would never end
+			if (m_transport_state == transport_state::PLAYING && m_global_tempo * m_relative_tempo <= 0)
+			{
+				const float tempo = m_global_tempo * m_relative_tempo;
+				const tick pattern_index = m_transport_position.m_pattern;
 				
-				advance_transport_by_one_tick(patterns);
+				restore();
+				
+				LIBTEQ_THROW_RUNTIME_ERROR("Cannot render at a tempo of " << tempo << " at pattern " << pattern_index)
+			}
+			
+			the_null_backend->run(period_size);
+			
+			for (size_t track_index = 0; track_index < tracks.size(); ++track_index)
+			{
+				auto &track_properties = *tracks[track_index].first;
+				null_backend::null_port &port = *((null_backend::null_port*)tracks[track_index].second);
 				
-				if (true == m_state_info_buffer.can_write())
+				switch(track_properties.m_type)
 				{
-					//std::cout << ".";
-					state_info info;
-					
-					info.m_transport_position = m_transport_position;
-					info.m_transport_state = m_transport_state;
-					info.m_loop_range = m_loop_range;
-					info.m_frame_time = jack_last_frame_time(m_jack_client) + frame_index;
-					info.m_is_tick = true;
-					
-					m_state_info_buffer.write(info);
+					case track::type::CV:
+						cv_buffers[track_index].insert(cv_buffers[track_index].end(), port.m_audio_buffer.begin(), port.m_audio_buffer.begin() + period_size);
+						break;
+						
+					case track::type::MIDI:
+						for (uint32_t event_index = 0; event_index < port.m_midi_buffer.m_number_of_events; ++event_index)
+						{
+							const null_backend::midi_buffer::event &the_event = port.m_midi_buffer.m_events[event_index];
+							midi_buffers[track_index].write(frame_time + the_event.m_time, the_event.m_data, the_event.m_size);
+						}
+						break;
+						
+					default:
+						break;
 				}
-
 			}
 			
-			write_cv_ports(frame_index);
+			frame_time += period_size;
+		}
+		
+		restore();
+		
+		std::vector<std::pair<std::string, const offline_midi_buffer*>> midi_tracks;
+		
+		for (size_t track_index = 0; track_index < tracks.size(); ++track_index)
+		{
+			auto &track_properties = *tracks[track_index].first;
 			
-			if (m_transport_state == transport_state::PLAYING)
+			switch(track_properties.m_type)
 			{
-				m_time_until_next_tick -= sample_duration;
+				case track::type::CV:
+					write_wav(wav_file_name_prefix + track_properties.m_name + ".wav", cv_buffers[track_index], sample_rate);
+					break;
+					
+				case track::type::MIDI:
+					midi_tracks.push_back(std::make_pair(track_properties.m_name, &midi_buffers[track_index]));
+					break;
+					
+				default:
+					break;
 			}
 		}
-
-		return 0;
+		
+		write_smf(midi_file_name, midi_tracks, sample_rate, beats_per_second);
+		
+		return frame_time;
 	}
 }
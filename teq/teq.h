@@ -8,79 +8,494 @@
 #include <functional>
 #include <utility>
 #include <stdexcept>
+#include <exception>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <deque>
+#include <set>
 #include <algorithm>
 #include <sstream>
 
-#include <jack/jack.h>
-#include <jack/midiport.h>
-
 #include <teq/ringbuffer.h>
+#include <teq/command.h>
+#include <teq/backend.h>
+#include <teq/null_backend.h>
+#include <teq/kernels.h>
+#include <teq/tick_clock.h>
 #include <teq/event.h>
 #include <teq/midi_event.h>
 #include <teq/song.h>
 #include <teq/range.h>
 #include <teq/transport.h>
 #include <teq/heap.h>
+#include <teq/seqlock.h>
+#include <teq/note_off_queue.h>
+#include <teq/offline.h>
 
 namespace teq
 {
 	extern "C" 
 	{
-		int jack_process(jack_nframes_t nframes, void *arg);
+		int process_callback(nframes_t nframes, void *arg);
 	}
 	
 	struct teq
 	{
+		/**
+		 * The state of the engine as of m_frame_time, i.e. the end of
+		 * the last process period. See get_state_info().
+		 */
 		struct state_info
 		{
 			transport_state m_transport_state;
 			transport_position m_transport_position;
 			loop_range m_loop_range;
-			jack_nframes_t m_frame_time;
-			bool m_is_tick;
+			nframes_t m_frame_time;
 		};
 		
-	protected:
-		jack_port_t *m_multi_out_port;
-		jack_port_t *m_midi_in_port;
+		/**
+		 * A tick that was played at m_frame_time. See 
+		 * set_tick_events_enabled().
+		 */
+		struct tick_event
+		{
+			transport_position m_transport_position;
+			nframes_t m_frame_time;
+		};
+		
+		/**
+		 * How recorded events are merged into the recorded track. See
+		 * start_recording().
+		 */
+		enum record_mode
+		{
+			//! Recorded events are added to the track, everything else is kept
+			OVERDUB,
+			
+			//! Ticks played while recording are cleared unless an event was recorded on them
+			REPLACE
+		};
 		
-		typedef std::function<void()> command;
+		/**
+		 * Called from the completion thread once the RT thread has
+		 * applied a change made via one of the *_async() methods.
+		 * Anything it throws is rethrown by the get() of the future
+		 * returned by that method.
+		 */
+		typedef std::function<void()> completion_callback;
 		
 		/**
-		 * A global heap for the one single data structure
-		 * that needs to be garbage collected..
+		 * A transaction collects any number of edits and hands them
+		 * to the RT thread in one go on commit(): a single song 
+		 * version plus a single command for the other settings. Each
+		 * setting changed via a mutator of teq waits for the next 
+		 * process period, and each song edit publishes a new song 
+		 * version. A transaction does both just once.
+		 *
+		 * The song edits are applied to a private copy of the song
+		 * which is made on the first song edit. The other settings are
+		 * just recorded. Nothing is visible to the RT thread before
+		 * commit().
+		 *
+		 * NOTE: Do not use the mutators of the teq while a transaction
+		 * is open. commit() throws if the song was changed in the 
+		 * meantime.
+		 *
+		 * NOTE: Ports for new tracks are registered right away, not on
+		 * commit(). They are unregistered again if the transaction is
+		 * destroyed without its song being published.
+		 */
+		struct transaction
+		{
+			transaction(teq &the_teq);
+			
+			~transaction();
+			
+			int number_of_tracks();
+			
+			int number_of_patterns();
+			
+			/**
+			 * Like teq::create_pattern() but for the tracks of this
+			 * transaction's song.
+			 */
+			pattern_ptr create_pattern(int length);
+			
+			void insert_midi_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
+			
+			void insert_cv_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
+			
+			void insert_control_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
+			
+			/**
+			 * The song gets a deep copy of the_pattern (see 
+			 * teq::insert_pattern()).
+			 */
+			void insert_pattern(int index, const pattern_ptr the_pattern);
+			
+			void set_pattern(int index, const pattern_ptr the_pattern);
+			
+			/**
+			 * Sets a single event. The pattern and the sequence are
+			 * copied on write: The first edit of a pattern in this
+			 * transaction copies the pattern sharing all sequences, and
+			 * the first edit of a sequence clones just that sequence.
+			 * All other patterns and sequences stay shared with the
+			 * current song.
+			 *
+			 * Implemented for midi_event, cv_event and control_event.
+			 */
+			template<class EventType>
+			void set_event(int pattern_index, int track_index, int tick_index, const EventType &event);
+			
+			//! Like set_event() but for any column of a track (see set_number_of_columns())
+			template<class EventType>
+			void set_column_event(int pattern_index, int track_index, int column_index, int tick_index, const EventType &event);
+			
+			//! See teq::set_midi_thru()
+			void set_midi_thru(int track_index, const midi_thru &thru);
+			
+			//! See teq::set_number_of_columns()
+			void set_number_of_columns(int track_index, int number_of_columns);
+			
+			void set_loop_range(const loop_range range);
+			
+			void set_global_tempo(float tempo);
+			
+			void set_ticks_per_beat(int ticks);
+			
+			void set_transport_state(transport_state state);
+			
+			void set_transport_source(transport_source source);
+			
+			void set_transport_position(transport_position position);
+			
+			void set_send_all_notes_off_on_loop(bool on);
+			
+			void set_send_all_notes_off_on_stop(bool on);
+			
+			/**
+			 * Applies all edits at once. Waits for the RT thread to pick
+			 * them up only if settings other than the song changed. A
+			 * transaction can only be committed once.
+			 */
+			void commit();
+			
+			/**
+			 * Like commit() but does not wait. See teq::write_command_async().
+			 */
+			std::future<void> commit_async(completion_callback callback = completion_callback());
+			
+		protected:
+			teq &m_teq;
+			
+			//! The song the transaction was opened on
+			song_ptr m_base_song;
+			
+			//! The private copy of the song. 0 until the first song edit
+			song_ptr m_song;
+			
+			//! Shared with the completion of an asynchronous commit
+			std::shared_ptr<transaction_state> m_state;
+			
+			bool m_committed;
+			
+			bool m_published;
+			
+			//! The ports of the tracks inserted by this transaction
+			std::vector<backend::port*> m_registered_ports;
+			
+			//! Compiles the song
+			void prepare_commit();
+			
+			//! Publishes the song if the transaction changed it
+			void publish_song();
+			
+			//! The private copy if there is one, the base song otherwise
+			song &current_song();
+			
+			//! Makes the private copy if needed
+			song_ptr edit_song();
+			
+			/**
+			 * The patterns and sequences that were copied on write.
+			 * Holding on to them makes sure their addresses are not 
+			 * reused.
+			 */
+			std::set<pattern_ptr> m_private_patterns;
+			
+			std::set<sequence_ptr> m_private_sequences;
+			
+			//! For copies made by this transaction, so they are edited in place
+			void mark_private(const pattern_ptr the_pattern);
+			
+			void check_open();
+			
+			void check_track_name_and_index_for_insert(const std::string &track_name, int index);
+		};
+		
+	protected:
+		backend::port *m_multi_out_port;
+		backend::port *m_midi_in_port;
+		
+		/**
+		 * Publishes the song versions to the RT thread and keeps them
+		 * alive while the RT thread might still use them.
+		 * m_reclamation_thread collects the versions it is done with.
 		 */
 		heap<song> m_song_heap;
 	
 		
 		lart::ringbuffer<command> m_command_buffer;
 		
-		lart::ringbuffer<state_info> m_state_info_buffer;
+		//! Written by the RT thread at the end of each period
+		seqlock<state_info> m_state_info;
+		
+		//! See has_state_info()
+		std::atomic<uint64_t> m_read_state_info_sequence;
+		
+		lart::ringbuffer<tick_event> m_tick_event_buffer;
+		
+		std::atomic<bool> m_tick_events_enabled;
+		
+		//! The tick events that did not fit into m_tick_event_buffer
+		std::atomic<uint64_t> m_dropped_tick_events;
+		
+		/**
+		 * What the RT thread captures while recording. Entries are
+		 * stamped with the position of the last tick played before 
+		 * they arrived, so the merger can place them without knowing
+		 * anything about frames.
+		 */
+		struct recorded_event
+		{
+			enum type { MESSAGE, TICK };
+			
+			type m_type;
+			
+			//! MESSAGE: The last tick played before the message arrived. TICK: The tick that was played
+			transport_position m_position;
+			
+			//! MESSAGE: How far into that tick the message arrived, in [0, 1)
+			float m_tick_fraction;
+			
+			midi::message m_message;
+		};
+		
+		//! The capacity of m_recorded_event_buffer
+		static const int recorded_event_buffer_size = 8192;
+		
+		lart::ringbuffer<recorded_event> m_recorded_event_buffer;
+		
+		//! Read by the RT thread. See start_recording()
+		std::atomic<bool> m_recording;
+		
+		//! The RT thread reports the ticks it plays while recording in REPLACE mode
+		std::atomic<bool> m_recording_replaces;
+		
+		//! The recorded events that did not fit into m_recorded_event_buffer
+		std::atomic<uint64_t> m_dropped_recorded_events;
+		
+		//! Fetched by the RT thread at the start of each period
+		void *m_midi_in_buffer;
+		
+		/**
+		 * The tick the RT thread played last and the frame it fired on
+		 * relative to the first frame of the current period. Only 
+		 * valid if m_has_played_tick is true.
+		 */
+		transport_position m_last_played_position;
+		
+		int64_t m_last_tick_frame;
+		
+		bool m_has_played_tick;
+		
+		/**
+		 * An event as it is going to be written into the recorded
+		 * track.
+		 */
+		struct recorded_edit
+		{
+			transport_position m_position;
+			
+			midi_event m_event;
+		};
+		
+		/**
+		 * What was recorded on a tick in the current pass. See 
+		 * merge_recorded_events().
+		 */
+		struct recorded_tick
+		{
+			//! m_recorded_ticks_played at the time
+			uint64_t m_ticks_played;
+			
+			midi_event::type m_type;
+		};
+		
+		/**
+		 * Guards the rest of the recording state and reading from
+		 * m_recorded_event_buffer.
+		 */
+		std::mutex m_recording_mutex;
+		
+		std::condition_variable m_recording_condition_variable;
+		
+		bool m_stop_recording_thread;
+		
+		//! Merges the recorded events into the song periodically
+		std::thread m_recording_thread;
+		
+		int m_recorded_track;
+		
+		record_mode m_record_mode;
+		
+		//! Edits not yet committed to the song
+		std::vector<recorded_edit> m_recorded_edits;
+		
+		std::map<std::pair<tick, tick>, recorded_tick> m_recorded_ticks;
+		
+		//! The number of TICK entries merged since start_recording()
+		uint64_t m_recorded_ticks_played;
+		
+		//! The recorded note that is still held down, -1 if none
+		int m_recorded_note;
+		
+		//! Why recorded edits were dropped. See stop_recording()
+		std::exception_ptr m_recording_error;
+		
+		/**
+		 * Makes checking whether the song was changed and publishing 
+		 * a new version one step, so the recording thread and the user
+		 * never silently overwrite each other's edits.
+		 */
+		std::mutex m_publish_mutex;
+		
+		/**
+		 * Held by the one-shot mutators (set_event(), insert_pattern(),
+		 * etc.) and the recording merge from creating their transaction
+		 * until it is committed, so they never see each other's edits
+		 * as a conflict.
+		 */
+		std::mutex m_edit_mutex;
+		
+		//! The capacity of m_note_off_queue
+		static const int note_off_queue_size = 1024;
+		
+		//! Only touched by the RT thread
+		note_off_queue m_note_off_queue;
+		
+		//! The number of frames the RT thread processed before the current period
+		int64_t m_period_start_frame;
+		
+		/**
+		 * Only touched by the RT thread. Set when the transport looped
+		 * or jumped and m_send_all_notes_off_on_loop is on. The notes
+		 * still sounding are ended on the next tick played or, if the
+		 * transport is stopped, right away.
+		 */
+		bool m_note_offs_pending;
+		
+		/**
+		 * Only touched by the RT thread. The frame (counted like 
+		 * m_period_start_frame) the notes of a stopped transport end 
+		 * on, or -1 if they have been ended already. Running off the
+		 * end of the song lets the last tick sound for its full
+		 * length.
+		 */
+		int64_t m_stop_frame;
 		
 		std::mutex m_ack_mutex;
 		
 		std::condition_variable m_ack_condition_variable;
 		
 		bool m_ack;
+		
+		/**
+		 * A change made via one of the *_async() methods that was not
+		 * yet applied by the RT thread.
+		 */
+		struct pending_completion
+		{
+			//! See write_command()
+			uint64_t m_sequence_number;
+			
+			std::promise<void> m_promise;
+			
+			completion_callback m_callback;
+			
+			//! Things the RT thread might still use
+			std::vector<std::shared_ptr<const void>> m_keep_alive;
+		};
+		
+		//! Guards writing to m_command_buffer and m_written_commands
+		std::mutex m_write_mutex;
+		
+		uint64_t m_written_commands;
+		
+		//! Written by the RT thread after executing each command
+		std::atomic<uint64_t> m_executed_commands;
+		
+		std::mutex m_completion_mutex;
+		
+		std::condition_variable m_completion_condition_variable;
+		
+		std::deque<pending_completion> m_pending_completions;
+		
+		bool m_stop_completion_thread;
+		
+		std::thread m_completion_thread;
+		
+		std::mutex m_reclamation_mutex;
+		
+		std::condition_variable m_reclamation_condition_variable;
+		
+		bool m_stop_reclamation_thread;
+		
+		//! Calls m_song_heap.gc() periodically
+		std::thread m_reclamation_thread;
 
 		
 		std::string m_client_name;
 		
-		jack_client_t *m_jack_client;
+		backend_ptr m_backend;
 		
+		//! Only touched by the RT thread. The transport state at the end of the last period
 		transport_state m_last_transport_state;
 		
-		jack_position_t m_last_jack_position;
-		jack_transport_state_t m_last_jack_transport_state;
+		backend::transport_info m_last_backend_transport;
 		
+		/**
+		 * The song version the non-RT side works on. It is the song
+		 * that was last published to the RT thread. Only ever accessed
+		 * via load_song() and publish_song().
+		 */
 		song_ptr m_song;
 		
+		/**
+		 * The song version the RT thread plays. It is only ever
+		 * touched by the RT thread. The RT thread picks up the latest 
+		 * published version at the start of each period. The song is 
+		 * kept alive by m_song_heap.
+		 */
+		song *m_rt_song;
+		
 		loop_range m_loop_range;
 		
 		float m_global_tempo;
 		
+		/**
+		 * The global tempo as last set with set_global_tempo(). 
+		 * m_global_tempo follows the GLOBAL_TEMPO events during 
+		 * playback, this is the tempo the tempo map assumes before the
+		 * first one (see tempo_map). Also read by the user thread in
+		 * position_to_frame() and frame_to_position().
+		 */
+		std::atomic<float> m_base_global_tempo;
+		
 		float m_relative_tempo;
 		
 		int m_ticks_per_beat;
@@ -91,7 +506,7 @@ namespace teq
 		
 		transport_position m_transport_position;
 		
-		double m_time_until_next_tick;
+		tick_clock m_tick_clock;
 		
 		
 		bool m_send_all_notes_off_on_loop;
@@ -100,14 +515,43 @@ namespace teq
 		
 	public:
 		
-		teq(const std::string client_name = "teq", int command_buffer_size = 1024, int state_info_buffer_size = 1024) :
+		/**
+		 * An offline instance does not connect to a jack server. It
+		 * uses a null_backend instead which is driven by render().
+		 */
+		teq(const std::string client_name = "teq", int command_buffer_size = 1024, int tick_event_buffer_size = 1024, bool offline = false) :
 			m_command_buffer(command_buffer_size),
- 			m_state_info_buffer(state_info_buffer_size),
+			m_tick_event_buffer(tick_event_buffer_size),
+			m_recorded_event_buffer(recorded_event_buffer_size),
+			m_note_off_queue(note_off_queue_size),
 			m_ack(false)
 		{
 			init
 			(
 				client_name,
+				create_backend(client_name, offline),
+				transport_state::STOPPED,
+				transport_position(),
+				true,
+				true
+			);
+		}
+		
+		/**
+		 * Use this constructor to run the engine on a backend of your
+		 * choice, e.g. a null_backend to clock the engine manually.
+		 */
+		teq(backend_ptr the_backend, int command_buffer_size = 1024, int tick_event_buffer_size = 1024) :
+			m_command_buffer(command_buffer_size),
+			m_tick_event_buffer(tick_event_buffer_size),
+			m_recorded_event_buffer(recorded_event_buffer_size),
+			m_note_off_queue(note_off_queue_size),
+			m_ack(false)
+		{
+			init
+			(
+				"teq",
+				the_backend,
 				transport_state::STOPPED,
 				transport_position(),
 				true,
@@ -117,12 +561,15 @@ namespace teq
 		
 		teq(const teq &other) :
 			m_command_buffer(other.m_command_buffer.size),
-			m_state_info_buffer(other.m_state_info_buffer.size),
+			m_tick_event_buffer(other.m_tick_event_buffer.size),
+			m_recorded_event_buffer(recorded_event_buffer_size),
+			m_note_off_queue(note_off_queue_size),
 			m_ack(false)
 		{
 			init
 			(
 				other.m_client_name,
+				create_backend(other.m_client_name, other.m_backend->is_clocked_manually()),
 				other.m_transport_state,
 				other.m_transport_position,
 				other.m_send_all_notes_off_on_loop,
@@ -130,9 +577,15 @@ namespace teq
 			);
 		}
 	
+		/**
+		 * Creates a jack_backend or, if offline is true, a null_backend.
+		 */
+		static backend_ptr create_backend(const std::string client_name, bool offline);
+		
 		void init
 		(
 			const std::string client_name,
+			backend_ptr the_backend,
 			transport_state the_transport_state,
 			transport_position the_transport_position,
 			bool send_all_notes_off_on_loop,
@@ -140,11 +593,53 @@ namespace teq
 		);
 		
 		~teq();
+		
+		/**
+		 * The *_async() methods do not wait for the RT thread. The
+		 * returned future becomes ready and the callback (if any) is
+		 * called from the completion thread once the change has been
+		 * applied. On a manually clocked backend the change is applied
+		 * and completed before the method returns. Changes are applied
+		 * in the order they were made. Song edits are visible to the
+		 * non-RT getters right away.
+		 */
+		std::future<void> set_send_all_notes_off_on_loop_async(bool on, completion_callback callback = completion_callback());
+		
+		std::future<void> set_send_all_notes_off_on_stop_async(bool on, completion_callback callback = completion_callback());
+		
+		std::future<void> insert_midi_track_async(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC, completion_callback callback = completion_callback());
+		
+		std::future<void> insert_cv_track_async(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC, completion_callback callback = completion_callback());
+		
+		std::future<void> insert_control_track_async(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC, completion_callback callback = completion_callback());
+		
+		std::future<void> insert_pattern_async(int index, const pattern_ptr the_pattern, completion_callback callback = completion_callback());
+		
+		std::future<void> set_pattern_async(int index, const pattern_ptr the_pattern, completion_callback callback = completion_callback());
+		
+		std::future<void> set_loop_range_async(const loop_range range, completion_callback callback = completion_callback());
+		
+		std::future<void> set_global_tempo_async(float tempo, completion_callback callback = completion_callback());
+		
+		std::future<void> set_ticks_per_beat_async(int ticks, completion_callback callback = completion_callback());
+		
+		std::future<void> set_transport_state_async(transport_state state, completion_callback callback = completion_callback());
+		
+		std::future<void> set_transport_source_async(transport_source source, completion_callback callback = completion_callback());
+		
+		std::future<void> set_transport_position_async(transport_position position, completion_callback callback = completion_callback());
 
 		void deactivate();
 		
+		/**
+		 * End the notes still sounding when the transport wraps around
+		 * to the loop start or jumps to another position. A note off 
+		 * goes out for each sounding note only (see 
+		 * send_sounding_note_offs()), not an all notes off controller.
+		 */
 		void set_send_all_notes_off_on_loop(bool on);
 		
+		//! Like set_send_all_notes_off_on_loop() but for stopping the transport
 		void set_send_all_notes_off_on_stop(bool on);
 		
 		bool track_name_exists(const std::string track_name);
@@ -157,11 +652,16 @@ namespace teq
 		
 		std::string track_name(int index);
 		
-		void insert_midi_track(const std::string track_name, int index);
+		/**
+		 * sequence_storage selects how the events of the new track are
+		 * stored in its patterns (see sequence::storage). The default
+		 * picks dense or sparse storage by the number of events.
+		 */
+		void insert_midi_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
 		
-		void insert_cv_track(const std::string track_name, int index);
+		void insert_cv_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
 		
-		void insert_control_track(const std::string track_name, int index);
+		void insert_control_track(const std::string track_name, int index, sequence::storage sequence_storage = sequence::AUTOMATIC);
 		
 		void remove_track(int index);
 		
@@ -174,22 +674,60 @@ namespace teq
 		
 		int number_of_ticks(int pattern_index);
 		
+		/**
+		 * The song gets a deep copy of the_pattern. So the_pattern can
+		 * be edited and set again later without affecting the song in
+		 * between, and the copy is compiled anew.
+		 */
 		void insert_pattern(int index, const pattern_ptr the_pattern);
 	
 		void remove_pattern(int index);
 		
 		void move_pattern(int from, int to);
 		
+		//! Like insert_pattern(), the song gets a deep copy
 		void set_pattern(int index, const pattern_ptr the_pattern);
+		
+		/**
+		 * Set a single event through a one-edit transaction. Only the
+		 * touched sequence is copied (see transaction::set_event()).
+		 * Use a transaction directly to set many events at once.
+		 */
+		template<class EventType>
+		void set_event(int pattern_index, int track_index, int tick_index, const EventType &event);
+		
+		template<class EventType>
+		void set_column_event(int pattern_index, int track_index, int column_index, int tick_index, const EventType &event);
+		
+		/**
+		 * Pass what arrives on the "in" port on to the midi track
+		 * track_index in the same period. The settings are compiled 
+		 * into a routing table looked up by status byte, so the RT 
+		 * thread does a constant amount of work per message and route.
+		 */
+		void set_midi_thru(int track_index, const midi_thru &thru);
+		
+		midi_thru get_midi_thru(int track_index);
+		
+		/**
+		 * Give the midi track track_index number_of_columns note columns
+		 * (1 to midi_track::max_number_of_columns), so chords play on 
+		 * its one port. The events of the columns that are kept stay,
+		 * the ones of dropped columns are gone.
+		 */
+		void set_number_of_columns(int track_index, int number_of_columns);
+		
+		int get_number_of_columns(int track_index);
 	
 		/**
 		 * Get a reference to a pattern in the song. Make sure
 		 * to make a copy before modifying it because
-		 * the RT thread also uses this data structure.
+		 * other song versions share this data structure.
 		 * Also make sure you create a DEEP copy of the 
 		 * pattern. Not just the pattern_ptr returned
 		 * from this method. See the method:
-		 * get_pattern_deep_copy()
+		 * get_pattern_deep_copy(). To change single events
+		 * use set_event() instead.
 		 */	
 		pattern_ptr get_pattern(int pattern_index);
 
@@ -229,14 +767,123 @@ namespace teq
 
 		void set_transport_position(transport_position position);
 		
+		/**
+		 * The frame (counted from the start of the song at the current
+		 * sample rate) on which the tick at position fires when the 
+		 * song is played from the start without looping. Tempo changes
+		 * by control events are taken into account. Before the first
+		 * GLOBAL_TEMPO event the tempo set with set_global_tempo() 
+		 * applies.
+		 */
+		int64_t position_to_frame(const transport_position position);
+		
+		/**
+		 * The inverse of position_to_frame(): The position of the last
+		 * tick that fired at or before frame. Frames past the end of
+		 * the song map to positions past the end of the last pattern.
+		 */
+		transport_position frame_to_position(int64_t frame);
+		
+		/**
+		 * For compatibility with code draining the state infos. True
+		 * if the state changed since the last get_state_info().
+		 */
 		bool has_state_info();
-
+		
+		/**
+		 * The latest state of the engine. This never waits for the RT
+		 * thread and can be called from any number of threads.
+		 */
 		state_info get_state_info();
 		
+		/**
+		 * If enabled, the RT thread reports every tick it plays
+		 * through a ringbuffer of tick_event_buffer_size entries (see
+		 * the constructors). Ticks that do not fit are dropped and 
+		 * counted (see dropped_tick_events()). Disabled by default.
+		 */
+		void set_tick_events_enabled(bool enabled);
+		
+		/**
+		 * has_tick_event() and get_tick_event() must only be called
+		 * from a single thread.
+		 */
+		bool has_tick_event();
+		
+		tick_event get_tick_event();
+		
+		uint64_t dropped_tick_events();
+		
+		/**
+		 * Records the channel voice messages arriving on the "in" port
+		 * into the midi track track_index while the transport is 
+		 * playing. The channel of the messages is ignored.
+		 *
+		 * The RT thread stamps each message with the tick it arrived
+		 * in. A background thread quantizes the messages to the 
+		 * nearest tick and commits them to the song every few 
+		 * milliseconds, copying only the sequences it touches. Since 
+		 * a track holds one event per tick, note events win over other
+		 * events on the same tick, and note offs that do not belong to
+		 * the last recorded note on are dropped.
+		 *
+		 * Messages that do not fit into the capture buffer are dropped
+		 * and counted (see dropped_recorded_events()).
+		 *
+		 * NOTE: The recording thread edits the song while recording, so 
+		 * a transaction of yours may throw on commit() because the 
+		 * song was changed. Just retry it. The one-shot mutators of 
+		 * teq (set_event() etc.) are serialized with the recording 
+		 * thread and never fail like that.
+		 */
+		void start_recording(int track_index, record_mode mode = OVERDUB);
+		
+		/**
+		 * Stops recording and merges what was recorded so far right
+		 * away. Rethrows the error that made a merge drop recorded 
+		 * events since the last call, if any.
+		 */
+		void stop_recording();
+		
+		bool is_recording();
+		
+		uint64_t dropped_recorded_events();
+		
+		/**
+		 * Frees the song versions the RT thread is done with right
+		 * away. There is no need to call this since it also happens 
+		 * periodically in the background.
+		 */
 		void gc();
 		
 		void wait();
 		
+		/**
+		 * Render the song faster than realtime. This is only available
+		 * on instances running on a null_backend (see the constructors).
+		 *
+		 * Playback starts at the current transport position and runs
+		 * until the end of the song, including the full length of its
+		 * last tick and the notes still sounding then. The loop range is ignored while
+		 * rendering. Afterwards the transport and the tempo are back 
+		 * where they were. Throws if the tempo is zero or negative, as
+		 * the song would never end then.
+		 *
+		 * All midi tracks are written to the standard midi file 
+		 * midi_file_name. Each CV track is written to a 32 bit float 
+		 * wav file named wav_file_name_prefix + track name + ".wav".
+		 *
+		 * Returns the number of rendered frames. This is always a
+		 * multiple of period_size.
+		 */
+		nframes_t render
+		(
+			const std::string &midi_file_name,
+			const std::string &wav_file_name_prefix,
+			nframes_t sample_rate = 48000,
+			nframes_t period_size = 1024
+		);
+		
 	protected:
 		/**
 		 * Convencience method to make a SHALLOW copy of the song.
@@ -257,53 +904,196 @@ namespace teq
 		/**
 		 * A deep copy of the song. This copy holds no more
 		 * references to data structures used in the RT thread.
-		 * with one notable exception: The jack ports are
+		 * with one notable exception: The backend ports are
 		 * not copied to avoid compromising connections
 		 * made to these ports.
 		*/
 		song_ptr copy_song_deep();
 
 		/**
-		 * RT-safe method to update the song data structure.
+		 * RT-safe method to update the song data structure. It does
+		 * not wait for the RT thread to pick up new_song.
 		 */
 		void update_song(song_ptr new_song);
+		
+		//! Make new_song the song the RT thread plays from the next period on
+		void publish_song(song_ptr new_song);
+		
+		//! A consistent snapshot of m_song
+		song_ptr load_song();
+
+		/**
+		 * Used by update_song() and transaction::commit(). Builds 
+		 * everything the RT thread needs to play new_song.
+		 */
+		void compile_song(song_ptr new_song);
 
 		/**
 		 * Used by update_song()
 		 */
 		void update_transport_lookup_list(song_ptr new_song);
 
+		/**
+		 * Used by update_song(). Compiles the schedules of all patterns
+		 * of new_song. Schedules of the current song are reused for
+		 * patterns that did not change as long as the tracks did not
+		 * change either.
+		 */
+		void update_schedule_list(song_ptr new_song);
 
-		void check_track_name_and_index_for_insert(const std::string track_name, int index);
+		/**
+		 * Used by update_song(). Builds the tempo_map of new_song from
+		 * its control event schedules. Call after the schedule list 
+		 * and the transport lookup list were updated.
+		 */
+		void update_tempo_map(song_ptr new_song);
+
+		/**
+		 * Used by update_song(). Builds the track_view of new_song.
+		 */
+		void update_track_view(song_ptr new_song);
+
+
+		static void check_pattern_for_song(const song &the_song, const pattern_ptr the_pattern);
+
+		static pattern_ptr create_pattern_for_song(const song &the_song, int length);
 			
 
 		/**
 		 * Convenience function to store a command in the 
-		 * command ringbuffer.
+		 * command ringbuffer. Returns the sequence number of the
+		 * command. The command was executed once m_executed_commands
+		 * reaches it.
 		 */
-		void write_command(command f);
+		uint64_t write_command(const command &the_command);
 		
 		/**
 		 * Function to pass a command in the command ringbuffer 
 		 * and wait until it has completed
 		 */
-		void write_command_and_wait(command f);
+		void write_command_and_wait(const command &the_command);
+		
+		/**
+		 * Pass a command to the RT thread without waiting. keep_alive
+		 * holds references to everything the command points to. They 
+		 * are dropped once the command has been executed.
+		 */
+		std::future<void> write_command_async(const command &the_command, completion_callback callback, std::vector<std::shared_ptr<const void>> keep_alive = std::vector<std::shared_ptr<const void>>());
+		
+		//! The body of m_completion_thread
+		void run_completions();
+		
+		//! The body of m_reclamation_thread
+		void run_reclamation();
+		
+		//! The body of m_recording_thread
+		void run_recording();
+		
+		/**
+		 * Turns the entries of m_recorded_event_buffer into edits and 
+		 * commits them. Expects m_recording_mutex to be held.
+		 */
+		void merge_recorded_events();
+		
+		//! The tick played after position, or position itself at the end of the song
+		static transport_position next_position(const song &the_song, const loop_range &the_loop_range, transport_position position);
 		
-		void render_event(const midi::midi_event &e, void *port_buffer, jack_nframes_t time);
+		//! The length of a tick in the_segment in subframes, as m_tick_clock computes it
+		static int64_t clock_tick_length(const tempo_map::segment &the_segment, float base_tempo, double sample_rate);
+		
+		/**
+		 * Completes all pending completions whose commands have been
+		 * executed. Expects lock to hold m_completion_mutex. The lock
+		 * is released while calling the callbacks.
+		 */
+		void complete_executed_commands(std::unique_lock<std::mutex> &lock);
+		
+		/**
+		 * Encode a midi_event other than ON and OFF. Returns false if
+		 * the event does not render to a message.
+		 */
+		static bool encode_event(const midi_event &the_event, unsigned char channel, midi::message &the_message);
+		
+		/**
+		 * The inverse of encode_event() including notes. Returns false
+		 * for messages that are not channel voice messages.
+		 */
+		static bool decode_message(const midi::message &the_message, midi_event &the_event);
 		
 		void process_commands();
 		
-		void write_cv_ports(int frame_index);
+		//! RT-safe
+		void execute_command(const command &the_command);
+		
+		/**
+		 * RT-safe. Carries over the runtime state of the tracks. Does
+		 * nothing if new_song is already playing.
+		 */
+		void switch_song(song *new_song);
+		
+		//! RT-safe
+		void apply_transaction_state(const transaction_state &state);
+		
+		/**
+		 * Render nframes frames of all CV tracks starting at frame_index
+		 * into their port buffers. Ramps started by the last tick are
+		 * stretched over the frames_until_next_tick frames. Unless
+		 * rolling is true (the transport plays at a positive tempo) 
+		 * ramps hold their current value.
+		 */
+		void write_cv_ports(nframes_t frame_index, nframes_t nframes, int64_t frames_until_next_tick, bool rolling);
+		
+		void fetch_port_buffers(nframes_t nframes);
 		
-		void fetch_port_buffers(jack_nframes_t nframes);
+		/**
+		 * RT-safe. Passes the events of the "in" port from event_index 
+		 * on that arrived before end_frame on to the midi tracks (see
+		 * midi_thru) and captures them while recording. Writes at the
+		 * frames the events arrived at, so call it before processing a
+		 * tick at end_frame.
+		 */
+		void process_midi_input(int64_t end_frame, uint32_t &event_index);
 		
-		void process_tick(transport_position position, jack_nframes_t frame, void *multi_out_buffer, const song::pattern_list &patterns);
+		/**
+		 * RT-safe. Sends the note offs of m_note_off_queue due before
+		 * end_frame (relative to the current period) and processes the 
+		 * events of the "in" port in between, so everything is written
+		 * in the order of frames.
+		 */
+		void process_until(int64_t end_frame, uint32_t &input_event_index, void *multi_out_buffer);
 		
-		void advance_transport_by_one_tick(const song::pattern_list &patterns);
+		//! RT-safe. Sends the note off of the_entry at frame
+		void send_note_off(const note_off_queue::entry &the_entry, nframes_t frame, void *multi_out_buffer);
+		
+		/**
+		 * RT-safe. Sends a note off for each sounding note of the midi
+		 * tracks (see midi_track_view::m_sounding_notes) at frame and
+		 * drops the pending ones of m_note_off_queue. Unlike an all 
+		 * notes off controller on all channels this sends nothing for
+		 * silent tracks and channels.
+		 */
+		void send_sounding_note_offs(nframes_t frame, void *multi_out_buffer);
+		
+		//! RT-safe. Called whenever the transport position changed other than by playing
+		void transport_jumped();
+		
+		void process_tick(transport_position position, nframes_t frame, void *multi_out_buffer, const song::pattern_list &patterns);
+		
+		//! Returns true if the transport wrapped around to the loop start
+		bool advance_transport_by_one_tick(const song::pattern_list &patterns);
+		
+		/**
+		 * The part of the process callback that runs after the
+		 * commands, port buffers and transport sync are taken care
+		 * of. It advances the transport over nframes frames writing
+		 * into the port buffers. frame_time is the time of the first
+		 * frame of the period.
+		 */
+		void process_frames(nframes_t nframes, double sample_rate, void *multi_out_buffer, nframes_t frame_time, const song::pattern_list &patterns);
 		
-		int process(jack_nframes_t nframes);
+		int process(nframes_t nframes);
 		
-		friend int jack_process(jack_nframes_t, void*);
+		friend int process_callback(nframes_t, void*);
 	};
 }
 
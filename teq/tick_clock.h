@@ -0,0 +1,113 @@
+#ifndef LIBTEQ_TICK_CLOCK_HH
+#define LIBTEQ_TICK_CLOCK_HH
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <teq/backend.h>
+
+namespace teq
+{
+	/**
+	 * A sample accurate tick clock working in the frame domain. Times
+	 * are 64 bit fixed point numbers of frames with 32 fractional bits
+	 * (subframes), so tick placement does not drift and is reproducible
+	 * to the sample.
+	 *
+	 * A tick fires on the first frame at or after its subframe time.
+	 */
+	struct tick_clock
+	{
+		static const int fractional_bits = 32;
+
+		static const int64_t subframes_per_frame = (int64_t)1 << fractional_bits;
+
+		//! The time of the next tick relative to the first frame of the current period
+		int64_t m_next_tick;
+
+		//! The length of one tick in subframes. Never shorter than one frame
+		int64_t m_tick_length;
+
+		//! The tempo m_tick_length was computed from
+		double m_ticks_per_second;
+
+		//! The sample rate m_tick_length was computed from
+		double m_sample_rate;
+
+		tick_clock() :
+			m_next_tick(0),
+			m_tick_length(subframes_per_frame),
+			m_ticks_per_second(0),
+			m_sample_rate(0)
+		{
+
+		}
+
+		/**
+		 * Recomputes the tick length, but only if the tempo or the sample
+		 * rate actually changed. The time of the next tick is not touched.
+		 */
+		void set_tempo(double ticks_per_second, double sample_rate)
+		{
+			if (ticks_per_second == m_ticks_per_second && sample_rate == m_sample_rate)
+			{
+				return;
+			}
+
+			m_ticks_per_second = ticks_per_second;
+			m_sample_rate = sample_rate;
+
+			m_tick_length = tick_length(ticks_per_second, sample_rate);
+		}
+
+		//! The length of one tick in subframes at that tempo
+		static int64_t tick_length(double ticks_per_second, double sample_rate)
+		{
+			const double frames_per_tick = sample_rate / ticks_per_second;
+
+			//! Also catches a tempo of zero and NaN. The clock then effectively stands still
+			if (false == (frames_per_tick < (double)(std::numeric_limits<int64_t>::max() >> (fractional_bits + 1))))
+			{
+				return std::numeric_limits<int64_t>::max() >> 1;
+			}
+
+			return std::max((int64_t)subframes_per_frame, (int64_t)llround(frames_per_tick * (double)subframes_per_frame));
+		}
+
+		/**
+		 * Let the next tick fire after fraction_of_tick times the tick
+		 * length. 0 means it fires on the first frame of the next period.
+		 */
+		void reset(double fraction_of_tick = 0)
+		{
+			m_next_tick = (int64_t)llround(fraction_of_tick * (double)m_tick_length);
+		}
+
+		//! The frame (relative to the current period) the next tick fires on
+		int64_t next_tick_frame() const
+		{
+			if (m_next_tick <= 0)
+			{
+				return 0;
+			}
+
+			return (m_next_tick + subframes_per_frame - 1) >> fractional_bits;
+		}
+
+		//! Call after the tick at next_tick_frame() was processed
+		void advance()
+		{
+			m_next_tick += m_tick_length;
+		}
+
+		//! Move the time origin to the start of the next period
+		void end_period(nframes_t nframes)
+		{
+			m_next_tick -= (int64_t)nframes << fractional_bits;
+		}
+	};
+} // namespace
+
+#endif
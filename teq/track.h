@@ -6,8 +6,14 @@
 #include <utility>
 #include <iostream>
 #include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
 
 #include <teq/event.h>
+#include <teq/persistent_vector.h>
 
 namespace teq
 {
@@ -17,16 +23,35 @@ namespace teq
 
 	struct sequence
 	{
+		/**
+		 * How the events of a sequence are stored. DENSE sequences
+		 * hold one event per tick, SPARSE ones only the events that
+		 * are not NONE. AUTOMATIC sequences switch between the two
+		 * depending on how many events they hold (see 
+		 * adapt_to_density()).
+		 */
+		enum storage { AUTOMATIC, DENSE, SPARSE };
+
 		virtual ~sequence() { }
 		
 		virtual void set_length(unsigned length) = 0;
 
 		bool m_muted;
 		
+		storage m_storage;
+		
 		virtual sequence_ptr clone() = 0;
 		
-		sequence() :
-			m_muted(false)
+		/**
+		 * Returns a copy in the representation that suits the
+		 * current number of events better or nullptr if this one
+		 * is fine. Only AUTOMATIC sequences are ever converted.
+		 */
+		virtual sequence_ptr adapt_to_density() const = 0;
+		
+		sequence(storage the_storage = AUTOMATIC) :
+			m_muted(false),
+			m_storage(the_storage)
 		{
 			
 		}
@@ -37,20 +62,463 @@ namespace teq
 	template<class EventType>
 	struct sequence_of : sequence
 	{
-		std::vector<EventType> m_events;
+		sequence_of(storage the_storage) :
+			sequence(the_storage)
+		{
+			
+		}
+		
+		virtual unsigned length() const = 0;
+		
+		//! The number of events that are not NONE
+		virtual size_t number_of_events() const = 0;
+		
+		virtual EventType get_event(unsigned tick_index) const = 0;
+		
+		virtual void set_event(unsigned tick_index, const EventType &event) = 0;
+		
+		//! Copies the events of the ticks [first_tick, first_tick + number_of_ticks) to events
+		virtual void get_events(unsigned first_tick, unsigned number_of_ticks, EventType *events) const = 0;
+		
+		//! Replaces the events of the ticks [first_tick, first_tick + number_of_ticks)
+		virtual void set_events(unsigned first_tick, unsigned number_of_ticks, const EventType *events) = 0;
+		
+		/**
+		 * Calls function(tick_index, event) for all events that are
+		 * not NONE in the order of their ticks. Use this instead of
+		 * get_event() to go through a whole sequence.
+		 */
+		template<class Function>
+		void for_each_event(Function function) const;
+	};
+	
+	/**
+	 * One event per tick. The events are stored in chunks shared 
+	 * between clones, so cloning a sequence and resizing it is cheap
+	 * and editing a single event of a clone copies only one chunk.
+	 */
+	template<class EventType>
+	struct dense_sequence_of : sequence_of<EventType>
+	{
+		persistent_vector<EventType> m_events;
+		
+		size_t m_number_of_events;
+		
+		dense_sequence_of(sequence::storage the_storage = sequence::AUTOMATIC) :
+			sequence_of<EventType>(the_storage),
+			m_number_of_events(0)
+		{
+			
+		}
 		
 		virtual void set_length(unsigned length) override
 		{
+			for (size_t tick_index = length; tick_index < m_events.size(); ++tick_index)
+			{
+				if (EventType::type::NONE != m_events[tick_index].m_type)
+				{
+					--m_number_of_events;
+				}
+			}
+			
 			m_events.resize(length);
 		}
 		
+		virtual unsigned length() const override
+		{
+			return (unsigned)m_events.size();
+		}
+		
+		virtual size_t number_of_events() const override
+		{
+			return m_number_of_events;
+		}
+		
+		virtual EventType get_event(unsigned tick_index) const override
+		{
+			return m_events[tick_index];
+		}
+		
+		virtual void set_event(unsigned tick_index, const EventType &event) override
+		{
+			const bool was_none = EventType::type::NONE == m_events[tick_index].m_type;
+			
+			const bool is_none = EventType::type::NONE == event.m_type;
+			
+			m_number_of_events = m_number_of_events + (was_none ? 1 : 0) - (is_none ? 1 : 0);
+			
+			m_events.set(tick_index, event);
+		}
+		
+		virtual void get_events(unsigned first_tick, unsigned number_of_ticks, EventType *events) const override
+		{
+			const size_t chunk_size = persistent_vector<EventType>::chunk_size;
+			
+			for (size_t tick_index = first_tick; tick_index < (size_t)first_tick + number_of_ticks;)
+			{
+				const size_t offset = tick_index % chunk_size;
+				const size_t count = std::min(chunk_size - offset, (size_t)first_tick + number_of_ticks - tick_index);
+				
+				const EventType *chunk = m_events.chunk_data(tick_index / chunk_size);
+				
+				std::copy(chunk + offset, chunk + offset + count, events + (tick_index - first_tick));
+				
+				tick_index += count;
+			}
+		}
+		
+		virtual void set_events(unsigned first_tick, unsigned number_of_ticks, const EventType *events) override
+		{
+			const size_t chunk_size = persistent_vector<EventType>::chunk_size;
+			
+			for (size_t tick_index = first_tick; tick_index < (size_t)first_tick + number_of_ticks;)
+			{
+				const size_t offset = tick_index % chunk_size;
+				const size_t count = std::min(chunk_size - offset, (size_t)first_tick + number_of_ticks - tick_index);
+				
+				EventType *chunk = m_events.mutable_chunk_data(tick_index / chunk_size);
+				
+				const EventType *source = events + (tick_index - first_tick);
+				
+				for (size_t index = 0; index < count; ++index)
+				{
+					const bool was_none = EventType::type::NONE == chunk[offset + index].m_type;
+					
+					const bool is_none = EventType::type::NONE == source[index].m_type;
+					
+					m_number_of_events = m_number_of_events + (was_none ? 1 : 0) - (is_none ? 1 : 0);
+					
+					chunk[offset + index] = source[index];
+				}
+				
+				tick_index += count;
+			}
+		}
+		
+		template<class Function>
+		void for_each_event(Function function) const
+		{
+			const size_t chunk_size = persistent_vector<EventType>::chunk_size;
+			
+			for (size_t chunk_index = 0; chunk_index < m_events.number_of_chunks(); ++chunk_index)
+			{
+				const EventType *events = m_events.chunk_data(chunk_index);
+				
+				const size_t start = chunk_index * chunk_size;
+				
+				const size_t end = std::min(m_events.size() - start, chunk_size);
+				
+				for (size_t offset = 0; offset < end; ++offset)
+				{
+					if (EventType::type::NONE != events[offset].m_type)
+					{
+						function((unsigned)(start + offset), events[offset]);
+					}
+				}
+			}
+		}
+		
+		virtual sequence_ptr clone() override
+		{
+			return sequence_ptr(new dense_sequence_of<EventType>(*this));
+		}
+		
+		virtual sequence_ptr adapt_to_density() const override;
+	};
+	
+	/**
+	 * Only the events that are not NONE, sorted by tick. Meant for
+	 * tracks that hold a handful of events, e.g. automation.
+	 */
+	template<class EventType>
+	struct sparse_sequence_of : sequence_of<EventType>
+	{
+		struct entry
+		{
+			uint32_t m_tick;
+			
+			EventType m_event;
+		};
+		
+		std::vector<entry> m_entries;
+		
+		unsigned m_length;
+		
+		sparse_sequence_of(sequence::storage the_storage = sequence::AUTOMATIC) :
+			sequence_of<EventType>(the_storage),
+			m_length(0)
+		{
+			
+		}
+		
+		//! The index of the first entry at or after tick_index
+		size_t next_event(unsigned tick_index) const
+		{
+			return (size_t)(std::lower_bound
+			(
+				m_entries.begin(), 
+				m_entries.end(), 
+				tick_index, 
+				[](const entry &the_entry, unsigned the_tick) { return the_entry.m_tick < the_tick; }
+			) - m_entries.begin());
+		}
+		
+		virtual void set_length(unsigned length) override
+		{
+			m_entries.erase(m_entries.begin() + (std::ptrdiff_t)next_event(length), m_entries.end());
+			
+			m_length = length;
+		}
+		
+		virtual unsigned length() const override
+		{
+			return m_length;
+		}
+		
+		virtual size_t number_of_events() const override
+		{
+			return m_entries.size();
+		}
+		
+		virtual EventType get_event(unsigned tick_index) const override
+		{
+			const size_t index = next_event(tick_index);
+			
+			if (index < m_entries.size() && m_entries[index].m_tick == tick_index)
+			{
+				return m_entries[index].m_event;
+			}
+			
+			return EventType();
+		}
+		
+		virtual void set_event(unsigned tick_index, const EventType &event) override
+		{
+			const size_t index = next_event(tick_index);
+			
+			const bool exists = index < m_entries.size() && m_entries[index].m_tick == tick_index;
+			
+			if (EventType::type::NONE == event.m_type)
+			{
+				if (exists)
+				{
+					m_entries.erase(m_entries.begin() + (std::ptrdiff_t)index);
+				}
+				
+				return;
+			}
+			
+			if (exists)
+			{
+				m_entries[index].m_event = event;
+			}
+			else
+			{
+				m_entries.insert(m_entries.begin() + (std::ptrdiff_t)index, entry{tick_index, event});
+			}
+		}
+		
+		virtual void get_events(unsigned first_tick, unsigned number_of_ticks, EventType *events) const override
+		{
+			std::fill(events, events + number_of_ticks, EventType());
+			
+			for (size_t index = next_event(first_tick); index < m_entries.size() && m_entries[index].m_tick < (size_t)first_tick + number_of_ticks; ++index)
+			{
+				events[m_entries[index].m_tick - first_tick] = m_entries[index].m_event;
+			}
+		}
+		
+		virtual void set_events(unsigned first_tick, unsigned number_of_ticks, const EventType *events) override
+		{
+			const size_t begin = next_event(first_tick);
+			
+			const size_t end = next_event(first_tick + number_of_ticks);
+			
+			std::vector<entry> new_entries(m_entries.begin(), m_entries.begin() + (std::ptrdiff_t)begin);
+			
+			for (unsigned index = 0; index < number_of_ticks; ++index)
+			{
+				if (EventType::type::NONE != events[index].m_type)
+				{
+					new_entries.push_back(entry{first_tick + index, events[index]});
+				}
+			}
+			
+			new_entries.insert(new_entries.end(), m_entries.begin() + (std::ptrdiff_t)end, m_entries.end());
+			
+			m_entries.swap(new_entries);
+		}
+		
+		template<class Function>
+		void for_each_event(Function function) const
+		{
+			for (const auto &the_entry : m_entries)
+			{
+				function((unsigned)the_entry.m_tick, the_entry.m_event);
+			}
+		}
+		
+		virtual sequence_ptr clone() override
+		{
+			return sequence_ptr(new sparse_sequence_of<EventType>(*this));
+		}
+		
+		virtual sequence_ptr adapt_to_density() const override;
+	};
+	
+	template<class EventType>
+	template<class Function>
+	void sequence_of<EventType>::for_each_event(Function function) const
+	{
+		if (auto dense = dynamic_cast<const dense_sequence_of<EventType>*>(this))
+		{
+			dense->for_each_event(function);
+		}
+		else
+		{
+			static_cast<const sparse_sequence_of<EventType>*>(this)->for_each_event(function);
+		}
+	}
+	
+	/**
+	 * An AUTOMATIC dense sequence turns sparse once less than one in 
+	 * 16 ticks holds an event, a sparse one turns dense once more than
+	 * one in 4 ticks does. The gap keeps sequences from flipping back
+	 * and forth while being edited.
+	 */
+	template<class EventType>
+	sequence_ptr dense_sequence_of<EventType>::adapt_to_density() const
+	{
+		if (sequence::AUTOMATIC != this->m_storage || m_number_of_events * 16 >= m_events.size())
+		{
+			return sequence_ptr();
+		}
+		
+		std::shared_ptr<sparse_sequence_of<EventType>> the_copy(new sparse_sequence_of<EventType>(this->m_storage));
+		
+		the_copy->m_muted = this->m_muted;
+		the_copy->m_length = length();
+		the_copy->m_entries.reserve(m_number_of_events);
+		
+		for_each_event
+		(
+			[&the_copy](unsigned tick_index, const EventType &event) 
+			{
+				the_copy->m_entries.push_back(typename sparse_sequence_of<EventType>::entry{tick_index, event}); 
+			}
+		);
+		
+		return the_copy;
+	}
+	
+	template<class EventType>
+	sequence_ptr sparse_sequence_of<EventType>::adapt_to_density() const
+	{
+		if (sequence::AUTOMATIC != this->m_storage || m_entries.size() * 4 <= m_length)
+		{
+			return sequence_ptr();
+		}
+		
+		std::shared_ptr<dense_sequence_of<EventType>> the_copy(new dense_sequence_of<EventType>(this->m_storage));
+		
+		the_copy->m_muted = this->m_muted;
+		the_copy->set_length(m_length);
+		
+		for (const auto &the_entry : m_entries)
+		{
+			the_copy->set_event(the_entry.m_tick, the_entry.m_event);
+		}
+		
+		return the_copy;
+	}
+	
+	//! Empty AUTOMATIC sequences start out sparse
+	template<class EventType>
+	sequence_ptr create_sequence_of(sequence::storage the_storage)
+	{
+		if (sequence::DENSE == the_storage)
+		{
+			return sequence_ptr(new dense_sequence_of<EventType>(the_storage));
+		}
+		
+		return sequence_ptr(new sparse_sequence_of<EventType>(the_storage));
+	}
+	
+	/**
+	 * The sequences of a track with more than one column (see 
+	 * midi_track::m_number_of_columns). Each column is a sequence of
+	 * its own that adapts to its density on its own, so this one never
+	 * gets converted.
+	 */
+	struct column_sequence : sequence
+	{
+		std::vector<sequence_ptr> m_columns;
+		
+		column_sequence(storage the_storage = AUTOMATIC) :
+			sequence(the_storage)
+		{
+			
+		}
+		
+		size_t number_of_columns() const
+		{
+			return m_columns.size();
+		}
+		
+		virtual void set_length(unsigned length) override
+		{
+			for (auto &it : m_columns)
+			{
+				it->set_length(length);
+			}
+		}
+		
 		virtual sequence_ptr clone() override
 		{
-			std::shared_ptr<sequence_of<EventType>> s(new sequence_of<EventType>());
-			s->m_events = m_events;
-			return s;
+			std::shared_ptr<column_sequence> the_copy(new column_sequence(m_storage));
+			
+			the_copy->m_muted = m_muted;
+			
+			for (auto &it : m_columns)
+			{
+				the_copy->m_columns.push_back(it->clone());
+			}
+			
+			return the_copy;
+		}
+		
+		virtual sequence_ptr adapt_to_density() const override
+		{
+			return sequence_ptr();
 		}
 	};
+	
+	/**
+	 * Calls function(column_index, tick_index, event) for all events of
+	 * a sequence of a track that are not NONE, column by column. A 
+	 * sequence that is not a column_sequence is column 0.
+	 */
+	template<class EventType, class Function>
+	void for_each_column_event(const sequence &the_sequence, Function function)
+	{
+		if (auto columns = dynamic_cast<const column_sequence*>(&the_sequence))
+		{
+			for (size_t column_index = 0; column_index < columns->number_of_columns(); ++column_index)
+			{
+				static_cast<const sequence_of<EventType>&>(*columns->m_columns[column_index]).for_each_event
+				(
+					[&function, column_index](unsigned tick_index, const EventType &event) { function((unsigned)column_index, tick_index, event); }
+				);
+			}
+		}
+		else
+		{
+			static_cast<const sequence_of<EventType>&>(the_sequence).for_each_event
+			(
+				[&function](unsigned tick_index, const EventType &event) { function(0u, tick_index, event); }
+			);
+		}
+	}
 
 	
 	struct track
@@ -63,12 +531,16 @@ namespace teq
 		
 		bool m_muted;
 		
+		//! The storage of the sequences created for this track
+		sequence::storage m_sequence_storage;
+		
 		virtual ~track() { }
 		
-		track(const std::string &name, type the_type = type::NONE)  :
+		track(const std::string &name, type the_type = type::NONE, sequence::storage sequence_storage = sequence::AUTOMATIC)  :
 			m_type(the_type),
 			m_name(name),
-			m_muted(false)
+			m_muted(false),
+			m_sequence_storage(sequence_storage)
 		{
 			
 		}
@@ -78,48 +550,147 @@ namespace teq
 
 	typedef std::shared_ptr<track> track_ptr;
 		
+	/**
+	 * How a midi track passes on the messages arriving on the "in" 
+	 * port (MIDI thru). The messages go out on the track's port in the
+	 * same period they arrived in. See midi_thru_table.
+	 */
+	struct midi_thru
+	{
+		//! The kinds of messages that can be filtered
+		enum message_kind
+		{
+			NOTES = 1,
+			POLYPHONIC_AFTERTOUCH = 2,
+			CONTROL_CHANGE = 4,
+			PROGRAM_CHANGE = 8,
+			CHANNEL_PRESSURE = 16,
+			PITCH_BEND = 32,
+			ALL = 63
+		};
+		
+		bool m_enabled;
+		
+		//! Only messages on this channel pass. -1 passes all channels
+		int m_input_channel;
+		
+		//! The channel the messages go out on. -1 keeps their channel
+		int m_output_channel;
+		
+		//! A combination of message_kind flags
+		unsigned m_message_kinds;
+		
+		//! Notes outside [m_lowest_note, m_highest_note] do not pass. Checked before transposing
+		int m_lowest_note;
+		
+		int m_highest_note;
+		
+		//! Added to notes. Notes transposed out of range are dropped
+		int m_transpose;
+		
+		//! Note on velocities are multiplied by this and clamped to [1, 127]
+		float m_velocity_scale;
+		
+		midi_thru() :
+			m_enabled(false),
+			m_input_channel(-1),
+			m_output_channel(-1),
+			m_message_kinds(ALL),
+			m_lowest_note(0),
+			m_highest_note(127),
+			m_transpose(0),
+			m_velocity_scale(1)
+		{
+			
+		}
+		
+		//! The message_kind of a status byte of a channel voice message
+		static unsigned message_kind_of(unsigned char status)
+		{
+			switch (status & 0xf0)
+			{
+				case 0x80:
+				case 0x90:
+					return NOTES;
+				case 0xa0:
+					return POLYPHONIC_AFTERTOUCH;
+				case 0xb0:
+					return CONTROL_CHANGE;
+				case 0xc0:
+					return PROGRAM_CHANGE;
+				case 0xd0:
+					return CHANNEL_PRESSURE;
+				case 0xe0:
+					return PITCH_BEND;
+				default:
+					return 0;
+			}
+		}
+	};
+	
+	/**
+	 * The track classes only hold the (cold) configuration. The hot 
+	 * state the RT thread works with lives in the track_view of the
+	 * song.
+	 */
 	struct midi_track : track
 	{
+		//! The size of the voice table of the RT thread (see midi_track_view::voice_table)
+		static const unsigned max_number_of_columns = 16;
+		
 		bool m_note_off_on_new_note_on;
 		
-		midi_event m_last_note_on_event;
-
 		unsigned char m_channel;
 		
-		void *m_port_buffer;
+		midi_thru m_thru;
+		
+		/**
+		 * The number of note columns. Each column plays one voice: an
+		 * OFF ends the note started in its own column and 
+		 * m_note_off_on_new_note_on applies per column. So a chord 
+		 * goes out on one port, one note per column.
+		 */
+		unsigned m_number_of_columns;
 		
-		midi_track(const std::string &name) : 
-			track(name, track::type::MIDI),
+		midi_track(const std::string &name, sequence::storage sequence_storage = sequence::AUTOMATIC) : 
+			track(name, track::type::MIDI, sequence_storage),
 			m_note_off_on_new_note_on(true),
-			m_channel(0)
+			m_channel(0),
+			m_number_of_columns(1)
 		{
 
 			
 		}
 		
+		//! Tracks with a single column get a plain sequence_of<midi_event>
 		virtual sequence_ptr create_sequence() override
 		{
-			return sequence_ptr(new sequence_of<midi_event>);
+			if (1 == m_number_of_columns)
+			{
+				return create_sequence_of<midi_event>(m_sequence_storage);
+			}
+			
+			std::shared_ptr<column_sequence> the_sequence(new column_sequence(m_sequence_storage));
+			
+			for (unsigned column_index = 0; column_index < m_number_of_columns; ++column_index)
+			{
+				the_sequence->m_columns.push_back(create_sequence_of<midi_event>(m_sequence_storage));
+			}
+			
+			return the_sequence;
 		}
 	};
 	
 	
 	struct cv_track : track
 	{
-		cv_event m_current_event;
-		
-		float m_current_value;
-		
-		void *m_port_buffer;
-		
 		virtual sequence_ptr create_sequence() override
 		{
-			return sequence_ptr(new sequence_of<cv_event>);
+			return create_sequence_of<cv_event>(m_sequence_storage);
 		}
 		
-		cv_track(const std::string &name) :
-			track(name, track::type::CV),
-			m_current_value(0)
+		cv_track(const std::string &name, sequence::storage sequence_storage = sequence::AUTOMATIC) :
+			track(name, track::type::CV, sequence_storage)
 		{
 			
 		}
@@ -129,11 +700,11 @@ namespace teq
 	{
 		virtual sequence_ptr create_sequence() override
 		{
-			return sequence_ptr(new sequence_of<control_event>);
+			return create_sequence_of<control_event>(m_sequence_storage);
 		}
 		
-		control_track(const std::string &name) :
-			track(name, track::type::CONTROL)
+		control_track(const std::string &name, sequence::storage sequence_storage = sequence::AUTOMATIC) :
+			track(name, track::type::CONTROL, sequence_storage)
 		{
 			
 		}
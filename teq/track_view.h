@@ -0,0 +1,444 @@
+#ifndef LIBTEQ_TRACK_VIEW_HH
+#define LIBTEQ_TRACK_VIEW_HH
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <teq/event.h>
+#include <teq/track.h>
+#include <teq/backend.h>
+#include <teq/midi_event.h>
+
+namespace teq
+{
+	/**
+	 * RT-safe. The index of the track with ports[index] among the
+	 * tracks with previous_ports or -1. A track is identified by its
+	 * port, which it keeps when its settings are changed (the track
+	 * object is replaced then). Tries the hint from previous_indices
+	 * first and falls back to a linear search if the hint refers to a
+	 * different song version.
+	 */
+	inline int find_previous_index(const std::vector<backend::port*> &ports, const std::vector<int> &previous_indices, size_t index, const std::vector<backend::port*> &previous_ports)
+	{
+		const int hint = previous_indices[index];
+
+		if (hint >= 0 && hint < (int)previous_ports.size() && previous_ports[(size_t)hint] == ports[index])
+		{
+			return hint;
+		}
+
+		for (size_t previous_index = 0; previous_index < previous_ports.size(); ++previous_index)
+		{
+			if (previous_ports[previous_index] == ports[index])
+			{
+				return (int)previous_index;
+			}
+		}
+
+		return -1;
+	}
+
+	/**
+	 * The midi thru settings of the midi tracks of a song version
+	 * compiled into one table. Which routes a message takes depends
+	 * on its status byte only, so the routes of all status bytes of
+	 * channel voice messages are laid out one after the other: The
+	 * routes of status are m_routes[m_status_offsets[status - 0x80]]
+	 * up to (excluding) m_routes[m_status_offsets[status - 0x80 + 1]].
+	 */
+	struct midi_thru_table
+	{
+		struct route
+		{
+			//! The index of the track among the midi tracks
+			uint32_t m_track_index;
+
+			//! The status byte the message goes out with
+			unsigned char m_status;
+
+			unsigned char m_lowest_note;
+
+			unsigned char m_highest_note;
+
+			int m_transpose;
+
+			float m_velocity_scale;
+		};
+
+		static const unsigned number_of_statuses = 0x70;
+
+		std::vector<uint32_t> m_status_offsets;
+
+		std::vector<route> m_routes;
+
+		midi_thru_table() :
+			m_status_offsets(number_of_statuses + 1, 0)
+		{
+
+		}
+
+		bool empty() const
+		{
+			return m_routes.empty();
+		}
+
+		//! Not RT-safe
+		void build(const std::vector<const midi_track*> &tracks)
+		{
+			m_routes.clear();
+
+			for (unsigned status_index = 0; status_index < number_of_statuses; ++status_index)
+			{
+				const unsigned char status = (unsigned char)(0x80 + status_index);
+
+				m_status_offsets[status_index] = (uint32_t)m_routes.size();
+
+				for (size_t track_index = 0; track_index < tracks.size(); ++track_index)
+				{
+					const midi_thru &thru = tracks[track_index]->m_thru;
+
+					if (false == thru.m_enabled || 0 == (thru.m_message_kinds & midi_thru::message_kind_of(status)))
+					{
+						continue;
+					}
+
+					if (thru.m_input_channel >= 0 && thru.m_input_channel != (status & 0x0f))
+					{
+						continue;
+					}
+
+					route the_route;
+
+					the_route.m_track_index = (uint32_t)track_index;
+					the_route.m_status = (unsigned char)((status & 0xf0) | ((thru.m_output_channel >= 0) ? (thru.m_output_channel & 0x0f) : (status & 0x0f)));
+					the_route.m_lowest_note = (unsigned char)std::max(0, std::min(127, thru.m_lowest_note));
+					the_route.m_highest_note = (unsigned char)std::max(0, std::min(127, thru.m_highest_note));
+					the_route.m_transpose = thru.m_transpose;
+					the_route.m_velocity_scale = thru.m_velocity_scale;
+
+					m_routes.push_back(the_route);
+				}
+			}
+
+			m_status_offsets[number_of_statuses] = (uint32_t)m_routes.size();
+		}
+
+		/**
+		 * RT-safe. Applies the_route to the_message. Returns false if
+		 * the message does not pass.
+		 */
+		static bool apply(const route &the_route, midi::message &the_message)
+		{
+			the_message.m_data[0] = the_route.m_status;
+
+			switch (the_route.m_status & 0xf0)
+			{
+				case midi::NOTE_ON:
+				case midi::NOTE_OFF:
+				case midi::POLYPHONIC_AFTERTOUCH:
+				{
+					const int note = the_message.m_data[1];
+
+					if (note < the_route.m_lowest_note || note > the_route.m_highest_note)
+					{
+						return false;
+					}
+
+					const int transposed_note = note + the_route.m_transpose;
+
+					if (transposed_note < 0 || transposed_note > 127)
+					{
+						return false;
+					}
+
+					the_message.m_data[1] = (unsigned char)transposed_note;
+
+					//! A velocity of 0 is a note off and stays one
+					if (midi::NOTE_ON == (the_route.m_status & 0xf0) && 0 != the_message.m_data[2])
+					{
+						const long velocity = lroundf((float)the_message.m_data[2] * the_route.m_velocity_scale);
+
+						the_message.m_data[2] = (unsigned char)std::max(1L, std::min(127L, velocity));
+					}
+
+					return true;
+				}
+
+				default:
+					return true;
+			}
+		}
+	};
+
+	/**
+	 * The notes sounding on the channels of a track, one bit per note
+	 * and channel. m_channels has the bit of each channel with notes
+	 * sounding set, so silent tracks cost one test.
+	 */
+	struct sounding_notes
+	{
+		uint64_t m_notes[16][2];
+
+		uint16_t m_channels;
+
+		sounding_notes() :
+			m_notes(),
+			m_channels(0)
+		{
+
+		}
+
+		bool empty() const
+		{
+			return 0 == m_channels;
+		}
+
+		void insert(unsigned char channel, unsigned char note)
+		{
+			m_notes[channel & 0x0f][(note >> 6) & 1] |= (uint64_t)1 << (note & 63);
+			m_channels = (uint16_t)(m_channels | (1 << (channel & 0x0f)));
+		}
+
+		void erase(unsigned char channel, unsigned char note)
+		{
+			uint64_t *notes = m_notes[channel & 0x0f];
+
+			notes[(note >> 6) & 1] &= ~((uint64_t)1 << (note & 63));
+
+			if (0 == notes[0] && 0 == notes[1])
+			{
+				m_channels = (uint16_t)(m_channels & ~(1 << (channel & 0x0f)));
+			}
+		}
+
+		//! Keeps track of the note ons and note offs among other messages
+		void update(const midi::message &the_message)
+		{
+			const unsigned char status = the_message.m_data[0] & 0xf0;
+
+			if (midi::NOTE_ON == status && 0 != the_message.m_data[2])
+			{
+				insert(the_message.m_data[0] & 0x0f, the_message.m_data[1]);
+			}
+			else if (midi::NOTE_ON == status || midi::NOTE_OFF == status)
+			{
+				erase(the_message.m_data[0] & 0x0f, the_message.m_data[1]);
+			}
+		}
+
+		//! Calls function(channel, note) for all sounding notes
+		template<class Function>
+		void for_each(Function function) const
+		{
+			for (unsigned channel = 0; channel < 16; ++channel)
+			{
+				if (0 == (m_channels & (1 << channel)))
+				{
+					continue;
+				}
+
+				for (unsigned word = 0; word < 2; ++word)
+				{
+					for (uint64_t bits = m_notes[channel][word]; 0 != bits; bits &= bits - 1)
+					{
+						function((unsigned char)channel, (unsigned char)(word * 64 + (unsigned)__builtin_ctzll(bits)));
+					}
+				}
+			}
+		}
+
+		void clear()
+		{
+			*this = sounding_notes();
+		}
+	};
+
+	/**
+	 * The RT thread's view of the midi tracks of a song version. It
+	 * holds the hot per-track state as a struct of arrays, so the
+	 * loops in the process callback only touch dense memory. The
+	 * index of a track in these arrays is its index among the midi
+	 * tracks of the song.
+	 */
+	struct midi_track_view
+	{
+		/**
+		 * The note last started in each column of a track or -1. An OFF
+		 * in a column ends that note.
+		 */
+		struct voice_table
+		{
+			signed char m_notes[midi_track::max_number_of_columns];
+
+			voice_table()
+			{
+				std::fill(m_notes, m_notes + midi_track::max_number_of_columns, -1);
+			}
+
+			//! The note ended by other means (e.g. its length ran out)
+			void release(unsigned char note)
+			{
+				std::replace(m_notes, m_notes + midi_track::max_number_of_columns, (signed char)note, (signed char)-1);
+			}
+		};
+
+		//! Cold: the track each entry belongs to
+		std::vector<const midi_track*> m_tracks;
+
+		/**
+		 * Cold: the index of the same track in the view this one was
+		 * derived from or -1 for new tracks. Used to carry over the
+		 * runtime state when the RT thread switches song versions.
+		 * The RT thread might skip versions, so this is only a hint
+		 * (see find_previous_index()).
+		 */
+		std::vector<int> m_previous_indices;
+
+		std::vector<backend::port*> m_ports;
+
+		std::vector<void*> m_port_buffers;
+
+		std::vector<unsigned char> m_channels;
+
+		std::vector<unsigned char> m_note_off_on_new_note_on;
+
+		std::vector<voice_table> m_voices;
+
+		//! The notes played by the sequencer that have not ended yet. MIDI thru is not tracked
+		std::vector<sounding_notes> m_sounding_notes;
+
+		//! Built by build_thru_table()
+		midi_thru_table m_thru_table;
+
+		size_t size() const
+		{
+			return m_tracks.size();
+		}
+
+		void push_back(const midi_track *the_track, backend::port *the_port, int previous_index)
+		{
+			m_tracks.push_back(the_track);
+			m_previous_indices.push_back(previous_index);
+			m_ports.push_back(the_port);
+			m_port_buffers.push_back(0);
+			m_channels.push_back(the_track->m_channel);
+			m_note_off_on_new_note_on.push_back(the_track->m_note_off_on_new_note_on);
+			m_voices.push_back(voice_table());
+			m_sounding_notes.push_back(sounding_notes());
+		}
+
+		//! Call after all tracks were added
+		void build_thru_table()
+		{
+			m_thru_table.build(m_tracks);
+		}
+
+		//! RT-safe
+		void transfer_state(const midi_track_view &previous)
+		{
+			for (size_t index = 0; index < size(); ++index)
+			{
+				const int previous_index = find_previous_index(m_ports, m_previous_indices, index, previous.m_ports);
+
+				if (previous_index >= 0)
+				{
+					m_voices[index] = previous.m_voices[(size_t)previous_index];
+					m_sounding_notes[index] = previous.m_sounding_notes[(size_t)previous_index];
+
+					//! Columns dropped since stay silent if they come back
+					std::fill(m_voices[index].m_notes + m_tracks[index]->m_number_of_columns, m_voices[index].m_notes + midi_track::max_number_of_columns, -1);
+				}
+			}
+		}
+	};
+
+	/**
+	 * Like midi_track_view, but for the CV tracks.
+	 */
+	struct cv_track_view
+	{
+		std::vector<const cv_track*> m_tracks;
+
+		std::vector<int> m_previous_indices;
+
+		std::vector<backend::port*> m_ports;
+
+		std::vector<float*> m_port_buffers;
+
+		//! The value of the next frame to be rendered
+		std::vector<float> m_current_values;
+
+		//! The value an INTERVAL ramp ends on
+		std::vector<float> m_ramp_end_values;
+
+		//! Added to the current value per frame while ramping
+		std::vector<float> m_ramp_increments;
+
+		/**
+		 * The number of frames left in the current ramp. A negative
+		 * value marks a ramp that just started and whose length (one
+		 * tick) is not yet resolved to frames.
+		 */
+		std::vector<int64_t> m_ramp_frames_left;
+
+		size_t size() const
+		{
+			return m_tracks.size();
+		}
+
+		void push_back(const cv_track *the_track, backend::port *the_port, int previous_index)
+		{
+			m_tracks.push_back(the_track);
+			m_previous_indices.push_back(previous_index);
+			m_ports.push_back(the_port);
+			m_port_buffers.push_back(0);
+			m_current_values.push_back(0);
+			m_ramp_end_values.push_back(0);
+			m_ramp_increments.push_back(0);
+			m_ramp_frames_left.push_back(0);
+		}
+
+		//! RT-safe
+		void transfer_state(const cv_track_view &previous)
+		{
+			for (size_t index = 0; index < size(); ++index)
+			{
+				const int previous_index = find_previous_index(m_ports, m_previous_indices, index, previous.m_ports);
+
+				if (previous_index >= 0)
+				{
+					m_current_values[index] = previous.m_current_values[(size_t)previous_index];
+					m_ramp_end_values[index] = previous.m_ramp_end_values[(size_t)previous_index];
+					m_ramp_increments[index] = previous.m_ramp_increments[(size_t)previous_index];
+					m_ramp_frames_left[index] = previous.m_ramp_frames_left[(size_t)previous_index];
+				}
+			}
+		}
+	};
+
+	/**
+	 * Built on the edit path whenever a song version is committed (see
+	 * teq::update_song()).
+	 */
+	struct track_view
+	{
+		midi_track_view m_midi_tracks;
+
+		cv_track_view m_cv_tracks;
+
+		//! RT-safe
+		void transfer_state(const track_view &previous)
+		{
+			m_midi_tracks.transfer_state(previous.m_midi_tracks);
+			m_cv_tracks.transfer_state(previous.m_cv_tracks);
+		}
+	};
+
+	typedef std::shared_ptr<track_view> track_view_ptr;
+} // namespace
+
+#endif